@@ -0,0 +1,481 @@
+/*
+ * Benchmarks decoding, buffer loading, streaming, and context updates.
+ *
+ * Each result is written to stdout as one JSON object per line, so runs can
+ * be collected and compared. Progress goes to stderr. Wave fixtures are always
+ * generated, and FLAC, Vorbis, Opus, and MP3 ones are too when built with
+ * libsndfile and it can encode them. Formats without a fixture are reported as
+ * skipped. Decode results name the decoder that handled each file. Files
+ * given on the command line are measured as well.
+ *
+ * Everything plays on a loopback device, mixed with Device::renderSamples, so
+ * the benchmarks run at CPU speed and don't depend on real-time playback.
+ *
+ * Usage: alure-bench [-quick] [files...]
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include "alure2.h"
+
+#ifdef HAVE_LIBSNDFILE
+#include <sndfile.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ElapsedNs(Clock::time_point start)
+{ return std::chrono::duration<double,std::nano>(Clock::now() - start).count(); }
+
+struct Fixture {
+    std::string mName;
+    std::string mFile;
+    bool mGenerated;
+};
+
+// Frames rendered at a time while playing.
+const ALCsizei sRenderFrames = 4410;
+// Big enough for a block of stereo float samples, the largest render format
+// the context could pick by default.
+std::vector<float> sRenderBuffer(sRenderFrames * 2);
+
+void Render(alure::Device *dev, double seconds)
+{
+    ALCsizei frames = ALCsizei(seconds * 44100.0);
+    while(frames > 0)
+    {
+        ALCsizei todo = std::min(frames, sRenderFrames);
+        dev->renderSamples(sRenderBuffer.data(), todo);
+        frames -= todo;
+    }
+}
+
+float ToneSample(uint32_t frame, uint16_t channel, uint32_t srate)
+{ return 0.5f * std::sin(float(frame) * (440.0f + 110.0f*channel) * 6.2831853f / srate); }
+
+
+void PutLE16(std::ostream &out, uint16_t val)
+{
+    char bytes[2] = { char(val&0xff), char((val>>8)&0xff) };
+    out.write(bytes, 2);
+}
+void PutLE32(std::ostream &out, uint32_t val)
+{
+    char bytes[4] = { char(val&0xff), char((val>>8)&0xff), char((val>>16)&0xff), char((val>>24)&0xff) };
+    out.write(bytes, 4);
+}
+
+// Writes a wave file with a few seconds of tone, so decoding does real work
+// on non-silent data.
+bool WriteWave(const std::string &fname, uint16_t channels, uint16_t bits, bool isfloat, uint32_t srate, uint32_t seconds)
+{
+    std::ofstream out(fname.c_str(), std::ios::binary);
+    if(!out) return false;
+
+    uint32_t frames = srate * seconds;
+    uint32_t blockalign = channels * bits / 8;
+    uint32_t datasize = frames * blockalign;
+
+    out.write("RIFF", 4);
+    PutLE32(out, 36 + datasize);
+    out.write("WAVE", 4);
+    out.write("fmt ", 4);
+    PutLE32(out, 16);
+    PutLE16(out, isfloat ? 0x0003 : 0x0001);
+    PutLE16(out, channels);
+    PutLE32(out, srate);
+    PutLE32(out, srate * blockalign);
+    PutLE16(out, blockalign);
+    PutLE16(out, bits);
+    out.write("data", 4);
+    PutLE32(out, datasize);
+
+    std::vector<char> block(blockalign);
+    for(uint32_t i = 0;i < frames;++i)
+    {
+        for(uint16_t c = 0;c < channels;++c)
+        {
+            float val = ToneSample(i, c, srate);
+            char *dst = &block[c * bits/8];
+            if(isfloat)
+                memcpy(dst, &val, 4);
+            else if(bits == 16)
+            {
+                int16_t sample = int16_t(val * 32767.0f);
+                dst[0] = char(sample&0xff);
+                dst[1] = char((sample>>8)&0xff);
+            }
+            else
+                dst[0] = char(uint8_t(val*127.0f + 128.0f));
+        }
+        out.write(block.data(), block.size());
+    }
+    return out.good();
+}
+
+/* libsndfile's codes for the compressed formats to generate fixtures in.
+ * They're spelled out so headers from before Opus or MP3 support still build;
+ * sf_format_check says whether the library can actually write them.
+ */
+enum : int {
+    SndFileFlac16 = 0x170000 | 0x0002,
+    SndFileVorbis = 0x200000 | 0x0060,
+    SndFileOpus = 0x200000 | 0x0064,
+    SndFileMp3 = 0x230000 | 0x0082,
+};
+
+// Writes a compressed file with a few seconds of stereo tone, or returns the
+// reason it couldn't.
+std::string WriteEncoded(const std::string &fname, int format, uint32_t srate, uint32_t seconds)
+{
+#ifdef HAVE_LIBSNDFILE
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.samplerate = srate;
+    info.channels = 2;
+    info.format = format;
+    if(!sf_format_check(&info))
+        return "libsndfile can't write this format";
+
+    SNDFILE *sndfile = sf_open(fname.c_str(), SFM_WRITE, &info);
+    if(!sndfile) return sf_strerror(nullptr);
+
+    std::vector<float> samples(srate * 2);
+    std::string err;
+    for(uint32_t sec = 0;sec < seconds && err.empty();++sec)
+    {
+        for(uint32_t i = 0;i < srate;++i)
+        {
+            samples[i*2 + 0] = ToneSample(sec*srate + i, 0, srate);
+            samples[i*2 + 1] = ToneSample(sec*srate + i, 1, srate);
+        }
+        if(sf_writef_float(sndfile, samples.data(), srate) != sf_count_t(srate))
+            err = sf_strerror(sndfile);
+    }
+    sf_close(sndfile);
+    if(!err.empty()) std::remove(fname.c_str());
+    return err;
+#else
+    (void)fname; (void)format; (void)srate; (void)seconds;
+    return "built without libsndfile";
+#endif
+}
+
+
+// Writes one result line, with the given named values.
+void Report(const std::string &bench, const std::string &name,
+            const std::vector<std::pair<std::string,double>> &values)
+{
+    std::ostringstream line;
+    line<< "{\"bench\":\""<<bench<<"\",\"name\":\""<<name<<"\"";
+    for(const auto &val : values)
+        line<< ",\""<<val.first<<"\":"<<val.second;
+    line<< "}";
+    std::cout<< line.str() <<std::endl;
+}
+
+double Percentile(std::vector<double> samples, double pct)
+{
+    if(samples.empty()) return 0.0;
+    std::sort(samples.begin(), samples.end());
+    size_t idx = std::min(samples.size()-1, size_t(pct * (samples.size()-1) + 0.5));
+    return samples[idx];
+}
+
+
+// Decoder::read throughput, reading each fixture start to end.
+void BenchDecode(alure::Context *ctx, const std::vector<Fixture> &fixtures, int reps)
+{
+    std::vector<char> data;
+    for(const Fixture &fixture : fixtures)
+    {
+        std::cerr<< "decode: "<<fixture.mName <<std::endl;
+        uint64_t frames = 0;
+        double ns = 0.0;
+        alure::ContextStats before = ctx->getStats();
+        try {
+            for(int rep = 0;rep < reps;++rep)
+            {
+                auto decoder = ctx->createDecoder(fixture.mFile);
+                ALuint chunk = 4096;
+                data.resize(alure::FramesToBytes(chunk, decoder->getChannelConfig(),
+                                                 decoder->getSampleType()));
+                auto start = Clock::now();
+                ALuint got;
+                while((got=decoder->read(data.data(), chunk)) > 0)
+                    frames += got;
+                ns += ElapsedNs(start);
+            }
+        }
+        catch(std::exception &e) {
+            std::cerr<< "  skipped: "<<e.what() <<std::endl;
+            continue;
+        }
+        // Whichever decoder's frame count went up is the one that read it.
+        std::string decoder = "unknown";
+        for(const alure::DecoderStats &dec : ctx->getStats().mDecoders)
+        {
+            auto iter = std::find_if(before.mDecoders.begin(), before.mDecoders.end(),
+                [&dec](const alure::DecoderStats &old) -> bool { return old.mName == dec.mName; }
+            );
+            uint64_t oldframes = (iter != before.mDecoders.end()) ? iter->mFramesDecoded : 0;
+            if(dec.mFramesDecoded > oldframes)
+                decoder = dec.mName;
+        }
+        Report("decode", fixture.mName+"/"+decoder, {
+            {"frames", double(frames)}, {"ns", ns},
+            {"mframes_per_sec", ns > 0.0 ? frames / ns * 1000.0 : 0.0}
+        });
+    }
+}
+
+// getBuffer is timed to completion. getBufferAsync is timed both for the call
+// to return, and until the buffer is ready to play.
+void BenchLoad(alure::Context *ctx, const std::vector<Fixture> &fixtures, int reps)
+{
+    for(const Fixture &fixture : fixtures)
+    {
+        std::cerr<< "load: "<<fixture.mName <<std::endl;
+        std::vector<double> sync, async_call, async_ready;
+        try {
+            for(int rep = 0;rep < reps;++rep)
+            {
+                auto start = Clock::now();
+                alure::Buffer *buffer = ctx->getBuffer(fixture.mFile);
+                sync.push_back(ElapsedNs(start));
+                ctx->removeBuffer(buffer);
+
+                start = Clock::now();
+                buffer = ctx->getBufferAsync(fixture.mFile);
+                async_call.push_back(ElapsedNs(start));
+                buffer->waitUntilReady();
+                async_ready.push_back(ElapsedNs(start));
+                ctx->removeBuffer(buffer);
+            }
+        }
+        catch(std::exception &e) {
+            std::cerr<< "  skipped: "<<e.what() <<std::endl;
+            continue;
+        }
+        Report("getBuffer", fixture.mName, {
+            {"median_us", Percentile(sync, 0.5)/1000.0}, {"p99_us", Percentile(sync, 0.99)/1000.0}
+        });
+        Report("getBufferAsync", fixture.mName, {
+            {"call_median_us", Percentile(async_call, 0.5)/1000.0},
+            {"call_p99_us", Percentile(async_call, 0.99)/1000.0},
+            {"ready_median_us", Percentile(async_ready, 0.5)/1000.0},
+            {"ready_p99_us", Percentile(async_ready, 0.99)/1000.0}
+        });
+    }
+}
+
+// Time spent rendering and decoding per stream, with more and more streams
+// playing at once.
+void BenchStreaming(alure::Device *dev, alure::Context *ctx, const Fixture &fixture, ALuint maxstreams, double seconds)
+{
+    for(ALuint count = 1;count <= maxstreams;count *= 2)
+    {
+        std::cerr<< "streaming: "<<count<<" streams" <<std::endl;
+        std::vector<alure::Source*> sources;
+        try {
+            for(ALuint i = 0;i < count;++i)
+            {
+                alure::Source *source = ctx->createSource();
+                sources.push_back(source);
+                source->setLooping(true);
+                source->play(ctx->createDecoder(fixture.mFile), 4096, 4);
+            }
+        }
+        catch(std::exception &e) {
+            std::cerr<< "  stopping: "<<e.what() <<std::endl;
+            for(alure::Source *source : sources)
+                source->release();
+            break;
+        }
+
+        alure::ContextStats before = ctx->getStats();
+        auto start = Clock::now();
+        Render(dev, seconds);
+        double ns = ElapsedNs(start);
+        alure::ContextStats after = ctx->getStats();
+
+        uint64_t decodens = 0;
+        for(const alure::DecoderStats &dec : after.mDecoders)
+            decodens += dec.mDecodeTime;
+        for(const alure::DecoderStats &dec : before.mDecoders)
+            decodens -= dec.mDecodeTime;
+
+        // Per second of audio played, not of time taken.
+        std::ostringstream name;
+        name<< fixture.mName<<"/"<<count;
+        Report("streaming", name.str(), {
+            {"streams", double(count)},
+            {"render_us_per_stream_sec", ns/1000.0/count/seconds},
+            {"decode_us_per_stream_sec", decodens/1000.0/count/seconds},
+            {"underruns", double(after.mUnderruns-before.mUnderruns)}
+        });
+
+        for(alure::Source *source : sources)
+            source->release();
+    }
+}
+
+// Cost of update() with many playing sources, each moved every frame.
+void BenchUpdate(alure::Device *dev, alure::Context *ctx, const Fixture &fixture, ALuint maxsources, int frames)
+{
+    alure::Buffer *buffer = ctx->getBuffer(fixture.mFile);
+    for(ALuint count = 16;count <= maxsources;count *= 2)
+    {
+        std::cerr<< "update: "<<count<<" sources" <<std::endl;
+        std::vector<alure::Source*> sources;
+        for(ALuint i = 0;i < count;++i)
+        {
+            alure::Source *source = ctx->createSource();
+            sources.push_back(source);
+            source->setLooping(true);
+            source->play(buffer);
+        }
+
+        std::vector<double> times;
+        double calls = 0.0;
+        for(int frame = 0;frame < frames;++frame)
+        {
+            for(size_t i = 0;i < sources.size();++i)
+            {
+                float angle = float(frame + i) * 0.01f;
+                sources[i]->setPosition(std::sin(angle)*10.0f, 0.0f, std::cos(angle)*10.0f);
+            }
+            auto start = Clock::now();
+            ctx->update();
+            times.push_back(ElapsedNs(start));
+            calls += ctx->getStats().mUpdateALCalls;
+
+            // Play a 60th of a second before the next frame.
+            Render(dev, 1.0/60.0);
+        }
+
+        alure::ContextStats stats = ctx->getStats();
+        std::ostringstream name;
+        name<< fixture.mName<<"/"<<count;
+        Report("update", name.str(), {
+            {"sources", double(count)},
+            {"median_us", Percentile(times, 0.5)/1000.0},
+            {"p99_us", Percentile(times, 0.99)/1000.0},
+            {"al_calls_per_update", calls / frames},
+            {"active", double(stats.mActiveSources)},
+            {"virtual", double(stats.mVirtualSources)}
+        });
+
+        for(alure::Source *source : sources)
+            source->release();
+    }
+    ctx->removeBuffer(buffer);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    bool quick = false;
+    std::vector<Fixture> fixtures;
+
+    const struct {
+        const char *name;
+        uint16_t channels, bits;
+        bool isfloat;
+    } wavespecs[] = {
+        { "wave-mono16", 1, 16, false },
+        { "wave-stereo8", 2, 8, false },
+        { "wave-stereo16", 2, 16, false },
+        { "wave-stereo32f", 2, 32, true },
+    };
+    for(const auto &spec : wavespecs)
+    {
+        std::string fname = std::string("alure-bench-")+spec.name+".wav";
+        if(!WriteWave(fname, spec.channels, spec.bits, spec.isfloat, 44100, 10))
+        {
+            std::cerr<< "Failed to write "<<fname <<std::endl;
+            return 1;
+        }
+        fixtures.push_back(Fixture{spec.name, fname, true});
+    }
+
+    // Opus only supports a few sample rates, 48khz being the usual one.
+    const struct {
+        const char *name;
+        const char *ext;
+        int format;
+        uint32_t srate;
+    } encspecs[] = {
+        { "flac-stereo16", "flac", SndFileFlac16, 44100 },
+        { "vorbis-stereo", "ogg", SndFileVorbis, 44100 },
+        { "opus-stereo", "opus", SndFileOpus, 48000 },
+        { "mp3-stereo", "mp3", SndFileMp3, 44100 },
+    };
+    for(const auto &spec : encspecs)
+    {
+        std::string fname = std::string("alure-bench-")+spec.name+"."+spec.ext;
+        std::string err = WriteEncoded(fname, spec.format, spec.srate, 10);
+        if(err.empty())
+            fixtures.push_back(Fixture{spec.name, fname, true});
+        else
+        {
+            std::cerr<< "No fixture for "<<spec.name<<": "<<err <<std::endl;
+            Report("decode", spec.name, {{"skipped", 1.0}});
+        }
+    }
+
+    for(int i = 1;i < argc;++i)
+    {
+        if(strcmp(argv[i], "-quick") == 0)
+            quick = true;
+        else
+            fixtures.push_back(Fixture{argv[i], argv[i], false});
+    }
+
+    alure::DeviceManager &devMgr = alure::DeviceManager::get();
+    alure::Device *dev;
+    try {
+        dev = devMgr.openLoopback();
+    }
+    catch(std::exception &e) {
+        std::cerr<< "Failed to open a loopback device: "<<e.what() <<std::endl;
+        return 1;
+    }
+
+    // Ask for enough sources to play everything at once, mixing at the rate
+    // Render assumes.
+    alure::Context *ctx = dev->createContext({{ALC_FREQUENCY, 44100},
+        {ALC_MONO_SOURCES, 4096}, {ALC_STEREO_SOURCES, 1024}});
+    alure::Context::MakeCurrent(ctx);
+
+    int reps = quick ? 2 : 10;
+    BenchDecode(ctx, fixtures, reps);
+    BenchLoad(ctx, fixtures, reps);
+    BenchStreaming(dev, ctx, fixtures[2], quick ? 64 : 1024, quick ? 0.5 : 2.0);
+    BenchUpdate(dev, ctx, fixtures[0], quick ? 256 : 4096, quick ? 50 : 200);
+
+    alure::Context::MakeCurrent(nullptr);
+    ctx->destroy();
+    dev->close();
+
+    for(const Fixture &fixture : fixtures)
+    {
+        if(fixture.mGenerated)
+            std::remove(fixture.mFile.c_str());
+    }
+
+    return 0;
+}
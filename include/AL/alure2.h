@@ -5,6 +5,7 @@
 #include <string>
 #include <memory>
 #include <utility>
+#include <future>
 #include <array>
 #include <cmath>
 
@@ -68,6 +69,7 @@ class Effect;
 class Decoder;
 class DecoderFactory;
 class MessageHandler;
+class VoiceScorer;
 
 
 // A SharedPtr implementation, defaults to C++11's std::shared_ptr. If this is
@@ -99,6 +101,11 @@ constexpr inline UniquePtr<T> MakeUnique(Args&&... args)
 template<typename T>
 using Vector = std::vector<T>;
 
+// A SharedFuture implementation, defaults to C++11's std::shared_future. If
+// this is changed, you must recompile the library.
+template<typename T>
+using SharedFuture = std::shared_future<T>;
+
 // A String implementation, default's to C++'s std::string. If this is changed,
 // you must recompile the library.
 using String = std::string;
@@ -146,6 +153,11 @@ public:
     constexpr const ALfloat& operator[](size_t i) const noexcept
     { return mValue[i]; }
 
+    constexpr bool operator==(const Vector3 &rhs) const noexcept
+    { return mValue[0] == rhs.mValue[0] && mValue[1] == rhs.mValue[1] && mValue[2] == rhs.mValue[2]; }
+    constexpr bool operator!=(const Vector3 &rhs) const noexcept
+    { return !(*this == rhs); }
+
 #define ALURE_DECL_OP(op)                                            \
     constexpr Vector3 operator op(const Vector3 &rhs) const noexcept \
     {                                                                \
@@ -292,6 +304,15 @@ public:
 
     /** Opens the playback device given by name, or the default if empty. */
     virtual Device *openPlayback(const String &name=String()) = 0;
+
+    /**
+     * Opens a loopback device, which mixes into memory on request with
+     * Device::renderSamples instead of playing through an output. This allows
+     * rendering faster than real time, such as for offline processing.
+     *
+     * Requires the ALC_SOFT_loopback extension.
+     */
+    virtual Device *openLoopback() = 0;
 };
 
 
@@ -361,6 +382,14 @@ public:
 
     /**
      * Creates a new Context on this device, using the specified attributes.
+     * If they include ALC_MONO_SOURCES or ALC_STEREO_SOURCES, that many
+     * sources are reserved (see Context::reserveSources) when the context is
+     * first made current.
+     *
+     * For loopback devices, the attributes also set the render format with
+     * ALC_FREQUENCY, ALC_FORMAT_CHANNELS_SOFT, and ALC_FORMAT_TYPE_SOFT. Any
+     * not given default to 44100hz, stereo, and float samples (or 16-bit
+     * samples if float isn't supported).
      */
     virtual Context *createContext(const Vector<AttributePair> &attributes=Vector<AttributePair>{}) = 0;
 
@@ -379,6 +408,22 @@ public:
      */
     virtual void resumeDSP() = 0;
 
+    /** Retrieves whether this device was opened with DeviceManager::openLoopback. */
+    virtual bool isLoopback() const = 0;
+
+    /**
+     * Renders the given number of sample frames into the buffer, in the
+     * format set when creating the device's context. If the current context
+     * is on this device, it's updated (as with Context::update) and its
+     * streams are refilled between each device update period as the samples
+     * are rendered, so playback proceeds the same no matter how quickly it's
+     * rendered. Source timing follows the samples rendered, not the wall
+     * clock.
+     *
+     * Only valid for loopback devices.
+     */
+    virtual void renderSamples(ALvoid *buffer, ALCsizei frames) = 0;
+
     /**
      * Closes and frees the device. All previously-created contexts must first
      * be destroyed.
@@ -397,6 +442,52 @@ enum class DistanceModel {
     None  = AL_NONE,
 };
 
+/** Priority classes for buffers loaded asynchronously. */
+enum class LoadPriority {
+    /** For sounds that aren't needed soon, e.g. ambience loaded ahead of time. */
+    Background,
+    /** The default priority. */
+    Normal,
+    /** For sounds needed right away. These are decoded before any others. */
+    Critical
+};
+
+/** Timing and throughput for one type of decoder, in a ContextStats. */
+struct DecoderStats {
+    /** The name the decoder factory was registered with. */
+    String mName;
+    /** Total time spent decoding, in nanoseconds. */
+    uint64_t mDecodeTime;
+    /** Total sample frames decoded. */
+    uint64_t mFramesDecoded;
+};
+
+/**
+ * A snapshot of a context's performance counters, as returned by
+ * Context::getStats. Counts accumulate over the life of the context.
+ */
+struct ContextStats {
+    /** Decode totals for each decoder type used so far. */
+    Vector<DecoderStats> mDecoders;
+    /** Times a playing stream ran out of decoded data. */
+    uint64_t mUnderruns;
+    /** Asynchronously loaded buffers still waiting to be decoded. */
+    ALuint mPendingBuffers;
+    /** Total time the background thread has spent working, in nanoseconds. */
+    uint64_t mBackgroundTime;
+    /** Buffer requests satisfied from the cache, and those that weren't. */
+    uint64_t mCacheHits;
+    uint64_t mCacheMisses;
+    /** Bytes of audio held by cached buffers. */
+    uint64_t mCacheBytes;
+    /** Sources playing through OpenAL, virtual sources, and idle OpenAL sources. */
+    ALuint mActiveSources;
+    ALuint mVirtualSources;
+    ALuint mFreeSources;
+    /** OpenAL calls made by the most recent call to update. */
+    ALuint mUpdateALCalls;
+};
+
 class ALURE_API Context {
 public:
     /** Makes the specified context current for OpenAL operations. */
@@ -442,10 +533,11 @@ public:
     virtual SharedPtr<MessageHandler> getMessageHandler() const = 0;
 
     /**
-     * Specifies the desired interval (in milliseconds) that the background
-     * thread will be woken up to process tasks, e.g. keeping streaming sources
-     * filled. An interval of 0 means the background thread will only be woken
-     * up manually with calls to update. The default is 0.
+     * Specifies the longest interval (in milliseconds) the background thread
+     * will sleep for between processing tasks. Streaming sources are scheduled
+     * to be refilled when their oldest queued buffer should finish playing, so
+     * the thread otherwise wakes on its own as needed. An interval of 0 means
+     * no limit. The default is 0.
      */
     virtual void setAsyncWakeInterval(ALuint msec) = 0;
 
@@ -454,6 +546,63 @@ public:
      */
     virtual ALuint getAsyncWakeInterval() const = 0;
 
+    /**
+     * Specifies the number of threads used to decode buffers loaded with
+     * getBufferAsync. A count of 0 uses one less than the number of hardware
+     * threads, with a minimum of one. Decoded buffers are still uploaded to
+     * OpenAL from the background thread. This must be set before the first
+     * asynchronous load. The default is 0.
+     */
+    virtual void setAsyncDecodeThreads(ALuint count) = 0;
+
+    /**
+     * Retrieves the number of threads set for asynchronous buffer decoding.
+     */
+    virtual ALuint getAsyncDecodeThreads() const = 0;
+
+    /**
+     * Specifies the maximum total storage size, in bytes, of the buffers
+     * cached by getBuffer and friends. When loading a new buffer would exceed
+     * this, the least recently used buffers that are loaded and not in use by
+     * a Source are removed as if by removeBuffer, and reported through
+     * MessageHandler::bufferEvicted. Buffer objects retrieved earlier must not
+     * be used after being evicted. A budget of 0 means no limit, which is the
+     * default. A new budget takes effect on the next buffer load.
+     */
+    virtual void setBufferCacheBudget(uint64_t bytes) = 0;
+
+    /** Retrieves the current buffer cache budget, in bytes. */
+    virtual uint64_t getBufferCacheBudget() const = 0;
+
+    /**
+     * Specifies the sample type the built-in decoders should output, for
+     * decoders created afterward. Vorbis, Opus, and MP3 (with mpg123) decode
+     * to float internally, so preferring SampleType::Float32 skips their
+     * conversion to 16-bit and keeps full precision. Float32 is only used if
+     * the context supports AL_EXT_FLOAT32, and other decoders keep their own
+     * type. Must be SampleType::Int16 or SampleType::Float32. The default is
+     * SampleType::Int16.
+     */
+    virtual void setPreferredSampleType(SampleType type) = 0;
+
+    /** Retrieves the sample type preferred for decoders. */
+    virtual SampleType getPreferredSampleType() const = 0;
+
+    /**
+     * Specifies a directory to cache decoded samples in, which must already
+     * exist. When set, a decoder created by createDecoder that's read through
+     * from the start (as when loading a buffer) has its samples written to
+     * the directory, and later decoders for the same file read them back from
+     * a memory-mapped copy instead of decoding again, including in later runs.
+     * Cached samples are matched to their file by name, size, and a hash of
+     * its contents, so changed files are decoded again. WAV files aren't
+     * cached. An empty path disables the cache, which is the default.
+     */
+    virtual void setDecodeCacheDirectory(const String &path) = 0;
+
+    /** Retrieves the directory decoded samples are cached in. */
+    virtual String getDecodeCacheDirectory() const = 0;
+
     /**
      * Creates a Decoder instance for the given audio file or resource name.
      */
@@ -470,6 +619,10 @@ public:
     /**
      * Creates and caches a Buffer for the given audio file or resource name.
      * Multiple calls with the same name will return the same Buffer object.
+     *
+     * If the buffer was requested with getBufferAsync and is still waiting
+     * for a decode thread, it's decoded right away on the calling thread
+     * instead.
      */
     virtual Buffer *getBuffer(const String &name) = 0;
 
@@ -483,6 +636,33 @@ public:
      */
     virtual Buffer *getBufferAsync(const String &name) = 0;
 
+    /**
+     * As above, but with the given priority. Loads are decoded in order of
+     * priority, so background content doesn't hold up sounds that are needed
+     * right away. If the name is already waiting to load with a lower
+     * priority, it's raised to the given one. getBufferAsync without a
+     * priority uses LoadPriority::Normal.
+     */
+    virtual Buffer *getBufferAsync(const String &name, LoadPriority priority) = 0;
+
+    /**
+     * Creates and caches Buffers for the given audio file or resource names,
+     * scheduling them for loading asynchronously as with getBufferAsync. This
+     * is more efficient than calling getBufferAsync for each name.
+     *
+     * The returned future becomes ready once every buffer in the list has
+     * finished loading, and holds the Buffer objects in the same order as the
+     * given names. Each Buffer must still be checked with a call to
+     * Buffer::getLoadStatus prior to being played, and must not be removed
+     * before the future is ready.
+     */
+    virtual SharedFuture<Vector<Buffer*>> getBuffersAsync(const Vector<String> &names) = 0;
+
+    /**
+     * As above, but with the given priority, as with getBufferAsync.
+     */
+    virtual SharedFuture<Vector<Buffer*>> getBuffersAsync(const Vector<String> &names, LoadPriority priority) = 0;
+
     /**
      * Deletes the cached Buffer object for the given audio file or
      * resource name. The buffer must not be in use by a Source.
@@ -500,6 +680,28 @@ public:
      */
     virtual Source *createSource() = 0;
 
+    /**
+     * Makes sure at least the given number of OpenAL sources are ready for
+     * playback, generating any that are missing all at once. Sources are
+     * otherwise generated as they're first played, which can be costly when
+     * many start together. Returns the number ready, which may be fewer than
+     * asked for if the device runs out.
+     */
+    virtual ALuint reserveSources(ALuint count) = 0;
+
+    /**
+     * Sets the position, velocity, and direction of many sources at once. The
+     * arrays hold three values (x, y, z) per source, in the same order as the
+     * sources, and any of them may be null to leave that property alone. The
+     * sources are checked before any are changed, and the changes are applied
+     * with the next call to update, as with the individual setters.
+     */
+    virtual void setSourceTransforms(Source *const *sources, size_t count, const ALfloat *positions,
+                                     const ALfloat *velocities, const ALfloat *directions) = 0;
+    void setSourceTransforms(const Vector<Source*> &sources, const ALfloat *positions,
+                             const ALfloat *velocities, const ALfloat *directions)
+    { setSourceTransforms(sources.data(), sources.size(), positions, velocities, directions); }
+
     virtual AuxiliaryEffectSlot *createAuxiliaryEffectSlot() = 0;
 
     virtual Effect *createEffect() = 0;
@@ -513,10 +715,53 @@ public:
 
     virtual void setDistanceModel(DistanceModel model) = 0;
 
+    /**
+     * Sets the most sources that may play through OpenAL at once. When more
+     * are playing buffers, the least important ones are made virtual: they
+     * give up their OpenAL source, but keep their properties and play
+     * position, and continue from the right place once there's room for them
+     * again. Sources are ranked by priority, then by score (see VoiceScorer).
+     * Voices are reassigned with each call to update. Streaming and paused
+     * sources are never made virtual, though they do count against the limit.
+     * 0 (the default) means no limit.
+     */
+    virtual void setMaxVoices(ALuint count) = 0;
+    virtual ALuint getMaxVoices() const = 0;
+
+    /**
+     * Sets the gain below which sources playing buffers are made virtual, as
+     * estimated from their gain, their distance to the listener, and the
+     * distance model. 0 (the default) means sources are never culled by gain.
+     */
+    virtual void setVoiceCullGain(ALfloat gain) = 0;
+    virtual ALfloat getVoiceCullGain() const = 0;
+
+    /**
+     * Sets a VoiceScorer instance, used to rank sources when deciding which
+     * lose their voice. Only one may be set for a context at a time, and the
+     * previously set one is returned. Without one, sources are ranked as with
+     * the base VoiceScorer.
+     */
+    virtual SharedPtr<VoiceScorer> setVoiceScorer(SharedPtr<VoiceScorer> scorer) = 0;
+
+    /** Gets the currently-set voice scorer. */
+    virtual SharedPtr<VoiceScorer> getVoiceScorer() const = 0;
+
+    /**
+     * Retrieves the context's performance counters. Only the per-decoder
+     * totals need a lock, held just long enough to copy them, so this is
+     * cheap enough to call every frame.
+     */
+    virtual ContextStats getStats() = 0;
+
     /**
      * Updates the context and all sources belonging to this context (you do
      * not need to call the individual sources' update method if you call this
      * function).
+     *
+     * Changes to most source properties (position, gain, pitch, etc) are held
+     * until this is called, and then applied all at once. Playing a source,
+     * updating it individually, or ending a batch also applies them.
      */
     virtual void update() = 0;
 };
@@ -601,6 +846,19 @@ public:
      */
     virtual BufferLoadStatus getLoadStatus() = 0;
 
+    /**
+     * Waits up to the given number of milliseconds for the buffer to finish
+     * loading, without using the CPU while waiting. If it's still waiting for
+     * a decode thread, it's given LoadPriority::Critical. Returns true once
+     * the buffer is ready, after which getLoadStatus will return
+     * BufferLoadStatus::Ready, or false if the time ran out first. Requires
+     * the buffer's context to be current.
+     */
+    virtual bool waitUntilReady(ALuint msec) = 0;
+
+    /** As above, but waits for as long as it takes. */
+    virtual void waitUntilReady() = 0;
+
     /** Retrieves the name the buffer was created with. */
     virtual const String &getName() const = 0;
 
@@ -623,6 +881,15 @@ public:
      * use.
      */
     virtual void play(SharedPtr<Decoder> decoder, ALuint updatelen, ALuint queuesize) = 0;
+    /**
+     * Plays the source by streaming audio from decoder, as above, but adapts
+     * the update length and queue size to the load. Streaming starts with the
+     * minimum sizes. The queue grows when the source underruns or decoding is
+     * slow, and shrinks again after a stretch of uninterrupted playback, never
+     * leaving the given bounds.
+     */
+    virtual void playAdaptive(SharedPtr<Decoder> decoder, ALuint minupdatelen, ALuint maxupdatelen,
+                              ALuint minqueuesize, ALuint maxqueuesize) = 0;
     /**
      * Stops playback, releasing the buffer or decoder reference.
      */
@@ -640,6 +907,14 @@ public:
     /** Specifies if the source is currently paused. */
     virtual bool isPaused() const = 0;
 
+    /**
+     * Specifies if the source is currently virtual, i.e. playing without an
+     * OpenAL source because the context culled it (see
+     * Context::setMaxVoices). A virtual source still counts as playing, and
+     * keeps its offset advancing.
+     */
+    virtual bool isVirtual() const = 0;
+
     /**
      * Specifies the source's playback priority. Lowest priority sources will
      * be evicted first when higher priority sources are played.
@@ -1064,8 +1339,8 @@ ALURE_API UniquePtr<DecoderFactory> UnregisterDecoder(const String &name);
 
 /**
  * A file I/O factory interface. Applications may derive from this and set an
- * instance to be used by the audio decoders. By default, the library uses
- * standard I/O.
+ * instance to be used by the audio decoders. By default, the library maps
+ * files into memory when possible, and uses standard I/O otherwise.
  */
 class ALURE_API FileIOFactory {
 public:
@@ -1088,6 +1363,25 @@ public:
     virtual UniquePtr<std::istream> openFile(const String &name) = 0;
 };
 
+/**
+ * Packs the named files into a sound bank, for use with MakeSoundBankFactory.
+ * Each file is opened with the current FileIOFactory and stored under its
+ * name in the bank's index, along with its format and the decoder that opened
+ * it, so loading it later can skip probing the other decoders. Throws if a
+ * file can't be opened or decoded, or if a name is given more than once.
+ */
+ALURE_API void WriteSoundBank(const String &filename, const Vector<String> &names);
+
+/**
+ * Creates a FileIOFactory that opens files from the given sound banks, to set
+ * with FileIOFactory::set. The banks are mapped into memory and their indices
+ * checked up front, so opening a file from one doesn't touch the filesystem.
+ * Banks are searched in the given order, and names not found in any of them
+ * are opened with the fallback factory, or as regular files if there is none.
+ * Throws if a bank can't be opened or is invalid.
+ */
+ALURE_API UniquePtr<FileIOFactory> MakeSoundBankFactory(const Vector<String> &banks, UniquePtr<FileIOFactory> fallback=nullptr);
+
 
 /**
  * A message handler interface. Applications may derive from this and set an
@@ -1157,8 +1451,66 @@ public:
      *         string means to stop trying.
      */
     virtual String resourceNotFound(const String &name);
+
+    /**
+     * Called when a cached buffer has been removed to stay within the budget
+     * set by Context::setBufferCacheBudget. The buffer is already deleted, so
+     * any Buffer object for it must no longer be used.
+     *
+     * \param name The resource name of the evicted buffer.
+     */
+    virtual void bufferEvicted(const String &name);
+};
+
+/**
+ * Ranks playing sources when there aren't enough voices for all of them: when
+ * OpenAL runs out of sources and a higher-priority source needs to play, or
+ * when a context's voice limit is reached (see Context::setMaxVoices). A
+ * source's priority always comes first, and the score decides between
+ * sources of equal priority, the lowest losing its voice first.
+ *
+ * Sources are scored as they start playing, and again on each call to
+ * Context::update, so the score should be quick to compute.
+ */
+class ALURE_API VoiceScorer {
+public:
+    virtual ~VoiceScorer();
+
+    /**
+     * Returns the score for the given source. The base method favors louder
+     * sources, and those with more than a second left to play.
+     *
+     * \param source The source being scored.
+     * \param gain The source's estimated gain at the listener, from its gain,
+     *        distance, and the distance model.
+     * \param remaining Estimated seconds of playback left, or infinity for
+     *        looping and streaming sources.
+     */
+    virtual ALfloat getScore(Source *source, ALfloat gain, ALfloat remaining);
 };
 
+/**
+ * Writes the trace events recorded so far, in the Chrome trace event JSON
+ * format (viewable with chrome://tracing or Perfetto). Events cover buffer
+ * loads and uploads, decoding, streaming, and playback, so stalls can be
+ * traced to their cause. They're only recorded when the library is built
+ * with ALURE_ENABLE_TRACING; otherwise an empty trace is written.
+ *
+ * Each thread keeps up to 16384 events. Once a thread's are used up, its
+ * further events are dropped (and counted in the trace's droppedEvents)
+ * until ClearTrace is called.
+ *
+ * \return true if tracing is enabled and the trace was written successfully.
+ */
+ALURE_API bool WriteTrace(std::ostream &stream);
+
+/**
+ * Discards the trace events recorded so far, so recording starts over. Call
+ * it after each WriteTrace to trace a long-running app in pieces. Memory held
+ * for threads that have ended is freed.
+ */
+ALURE_API void ClearTrace();
+
 } // namespace alure
 
 #endif /* AL_ALURE2_H */
@@ -11,14 +11,15 @@
 #include "alext.h"
 
 #include "context.h"
+#include "trace.h"
 
 namespace alure
 {
 
 void ALBuffer::cleanup()
 {
-    while(!mIsLoaded.load(std::memory_order_acquire))
-        std::this_thread::yield();
+    if(!mIsLoaded.load(std::memory_order_acquire))
+        mContext->waitForLoad(this);
     if(isInUse())
         throw std::runtime_error("Buffer is in use");
 
@@ -30,9 +31,16 @@ void ALBuffer::cleanup()
 }
 
 
-void ALBuffer::load(ALuint frames, ALenum format, SharedPtr<Decoder> decoder, const String &name, ALContext *ctx)
+void ALBuffer::addSource(Source *source)
 {
-    Vector<ALbyte> data(FramesToBytes(frames, mChannelConfig, mSampleType));
+    mSources.push_back(source);
+    mContext->touchBuffer(this);
+}
+
+
+void ALBuffer::decode(ALuint frames, Decoder *decoder, Vector<ALbyte> &data, std::pair<uint64_t,uint64_t> &loop_pts) const
+{
+    data.resize(FramesToBytes(frames, mChannelConfig, mSampleType));
 
     ALuint got = decoder->read(data.data(), frames);
     if(got > 0)
@@ -48,7 +56,7 @@ void ALBuffer::load(ALuint frames, ALenum format, SharedPtr<Decoder> decoder, co
         std::fill(data.begin(), data.end(), silence);
     }
 
-    std::pair<uint64_t,uint64_t> loop_pts = decoder->getLoopPoints();
+    loop_pts = decoder->getLoopPoints();
     if(loop_pts.first >= loop_pts.second)
         loop_pts = std::make_pair(0, frames);
     else
@@ -56,9 +64,13 @@ void ALBuffer::load(ALuint frames, ALenum format, SharedPtr<Decoder> decoder, co
         loop_pts.second = std::min<uint64_t>(loop_pts.second, frames);
         loop_pts.first = std::min<uint64_t>(loop_pts.first, loop_pts.second-1);
     }
+}
 
+void ALBuffer::load(ALenum format, const Vector<ALbyte> &data, std::pair<uint64_t,uint64_t> loop_pts, ALContext *ctx)
+{
+    ALURE_TRACE_ZONE("ALBuffer::load");
     ctx->send(&MessageHandler::bufferLoading,
-        name, mChannelConfig, mSampleType, mFrequency, data
+        mName, mChannelConfig, mSampleType, mFrequency, data
     );
 
     alBufferData(mId, format, data.data(), data.size(), mFrequency);
@@ -67,24 +79,28 @@ void ALBuffer::load(ALuint frames, ALenum format, SharedPtr<Decoder> decoder, co
         ALint pts[2]{(ALint)loop_pts.first, (ALint)loop_pts.second};
         alBufferiv(mId, AL_LOOP_POINTS_SOFT, pts);
     }
+    setLength(data.size() / FramesToBytes(1, mChannelConfig, mSampleType), loop_pts);
 
     mIsLoaded.store(true, std::memory_order_release);
 }
 
+void ALBuffer::setLength(ALuint length, std::pair<uint64_t,uint64_t> loop_pts)
+{
+    mLength = length;
+    // Without loop point support, the whole buffer loops.
+    if(mContext->hasExtension(SOFT_loop_points))
+        mLoopPts = std::make_pair((ALuint)loop_pts.first, (ALuint)loop_pts.second);
+    else
+        mLoopPts = std::make_pair(0, length);
+}
+
 
 ALuint ALBuffer::getLength() const
 {
     CheckContext(mContext);
     if(mLoadStatus != BufferLoadStatus::Ready)
         throw std::runtime_error("Buffer not loaded");
-
-    ALint size=-1, bits=-1, chans=-1;
-    alGetBufferi(mId, AL_SIZE, &size);
-    alGetBufferi(mId, AL_BITS, &bits);
-    alGetBufferi(mId, AL_CHANNELS, &chans);
-    if(size < 0 || bits < 0 || chans < 0)
-        throw std::runtime_error("Buffer format error");
-    return size / chans * 8 / bits;
+    return mLength;
 }
 
 ALuint ALBuffer::getSize() const
@@ -122,6 +138,7 @@ void ALBuffer::setLoopPoints(ALuint start, ALuint end)
     alBufferiv(mId, AL_LOOP_POINTS_SOFT, pts);
     if(alGetError() != AL_NO_ERROR)
         throw std::runtime_error("Failed to set loop points");
+    mLoopPts = std::make_pair(start, end);
 }
 
 std::pair<ALuint,ALuint> ALBuffer::getLoopPoints() const
@@ -129,16 +146,7 @@ std::pair<ALuint,ALuint> ALBuffer::getLoopPoints() const
     CheckContext(mContext);
     if(mLoadStatus != BufferLoadStatus::Ready)
         throw std::runtime_error("Buffer not loaded");
-
-    if(!mContext->hasExtension(SOFT_loop_points))
-        return std::make_pair(0, getLength());
-
-    ALint pts[2]{-1,-1};
-    alGetBufferiv(mId, AL_LOOP_POINTS_SOFT, pts);
-    if(pts[0] == -1 || pts[1] == -1)
-        throw std::runtime_error("Failed to get loop points");
-
-    return std::make_pair(pts[0], pts[1]);
+    return mLoopPts;
 }
 
 
@@ -151,10 +159,30 @@ BufferLoadStatus ALBuffer::getLoadStatus()
      * others.
      */
     if(mLoadStatus == BufferLoadStatus::Pending && mIsLoaded.load(std::memory_order_acquire))
+    {
         mLoadStatus = BufferLoadStatus::Ready;
+        mPendingLoad = nullptr;
+    }
     return mLoadStatus;
 }
 
+bool ALBuffer::waitUntilReady(ALuint msec)
+{
+    CheckContext(mContext);
+    if(!mIsLoaded.load(std::memory_order_acquire) &&
+       !mContext->waitForLoad(this, std::chrono::milliseconds(msec)))
+        return false;
+    return getLoadStatus() == BufferLoadStatus::Ready;
+}
+
+void ALBuffer::waitUntilReady()
+{
+    CheckContext(mContext);
+    if(!mIsLoaded.load(std::memory_order_acquire))
+        mContext->waitForLoad(this);
+    getLoadStatus();
+}
+
 
 ALURE_API const char *GetSampleTypeName(SampleType type)
 {
@@ -4,6 +4,7 @@
 #include "main.h"
 
 #include <algorithm>
+#include <future>
 
 #include "al.h"
 
@@ -15,6 +16,45 @@ class ALContext;
 
 ALenum GetFormat(ChannelConfig chans, SampleType type);
 
+// A group of buffers loaded together with Context::getBuffersAsync. The
+// promise is satisfied once the last remaining buffer is loaded.
+struct BufferBatch {
+    std::promise<Vector<Buffer*>> mPromise;
+    Vector<Buffer*> mBuffers;
+    size_t mRemaining;
+
+    BufferBatch() : mRemaining(0) { }
+};
+
+class ALBuffer;
+
+// A buffer waiting to be loaded asynchronously. Whichever thread claims it
+// first decodes it, either a decode thread or the app thread if it asks for
+// the buffer with Context::getBuffer.
+struct PendingBuffer {
+    ALBuffer *mBuffer;
+    SharedPtr<Decoder> mDecoder;
+    ALenum mFormat;
+    ALuint mFrames;
+    // Highest priority it's been queued with. Only used by the app thread.
+    LoadPriority mPriority;
+
+    // Filled in by the claiming thread
+    Vector<ALbyte> mData;
+    std::pair<uint64_t,uint64_t> mLoopPts;
+
+    std::atomic<bool> mClaimed;
+
+    PendingBuffer()
+      : mBuffer(nullptr), mFormat(AL_NONE), mFrames(0), mPriority(LoadPriority::Normal),
+        mLoopPts{0,0}, mClaimed(false)
+    { }
+
+    bool isClaimed() const { return mClaimed.load(std::memory_order_acquire); }
+    // Returns true if the calling thread got to it first.
+    bool claim() { return !mClaimed.exchange(true, std::memory_order_acq_rel); }
+};
+
 class ALBuffer : public Buffer {
     ALContext *const mContext;
     ALuint mId;
@@ -23,18 +63,38 @@ class ALBuffer : public Buffer {
     ChannelConfig mChannelConfig;
     SampleType mSampleType;
 
+    // Kept once loaded, so they can be read without querying OpenAL.
+    ALuint mLength;
+    std::pair<ALuint,ALuint> mLoopPts;
+
     BufferLoadStatus mLoadStatus;
     std::atomic<bool> mIsLoaded;
 
     Vector<Source*> mSources;
 
+    // Batches waiting on this buffer to load. Protected by the context's
+    // batch mutex.
+    Vector<SharedPtr<BufferBatch>> mBatches;
+
+    // The load this buffer is waiting on, if any. Only used by the app thread,
+    // and dropped once the buffer is seen to be ready.
+    SharedPtr<PendingBuffer> mPendingLoad;
+
     const String mName;
 
+    // Least-recently-used list links and accounting, maintained by the
+    // context's BufferCache.
+    ALBuffer *mLruOlder, *mLruNewer;
+    uint64_t mCacheSize;
+    uint64_t mLastUse;
+    friend class BufferCache;
+
 public:
     ALBuffer(ALContext *context, ALuint id, ALuint freq, ChannelConfig config, SampleType type, bool preloaded, const String &name)
       : mContext(context), mId(id), mFrequency(freq), mChannelConfig(config), mSampleType(type),
-        mLoadStatus(preloaded ? BufferLoadStatus::Ready : BufferLoadStatus::Pending),
-        mIsLoaded(preloaded), mName(name)
+        mLength(0), mLoopPts{0,0}, mLoadStatus(preloaded ? BufferLoadStatus::Ready : BufferLoadStatus::Pending),
+        mIsLoaded(preloaded), mName(name), mLruOlder(nullptr), mLruNewer(nullptr),
+        mCacheSize(0), mLastUse(0)
     { }
     virtual ~ALBuffer() { }
 
@@ -43,16 +103,34 @@ public:
     ALContext *getContext() { return mContext; }
     ALuint getId() const { return mId; }
 
-    void addSource(Source *source) { mSources.push_back(source); }
+    void addSource(Source *source);
     void removeSource(Source *source)
     {
         auto iter = std::find(mSources.cbegin(), mSources.cend(), source);
         if(iter != mSources.cend()) mSources.erase(iter);
     }
 
-    void load(ALuint frames, ALenum format, SharedPtr<Decoder> decoder, const String &name, ALContext *ctx);
+    // Decodes the buffer's audio data. May be called from any thread.
+    void decode(ALuint frames, Decoder *decoder, Vector<ALbyte> &data, std::pair<uint64_t,uint64_t> &loop_pts) const;
+    // Uploads decoded audio data and marks the buffer as loaded. The context
+    // must be current on the calling thread.
+    void load(ALenum format, const Vector<ALbyte> &data, std::pair<uint64_t,uint64_t> loop_pts, ALContext *ctx);
+    // Records the length and loop points of the uploaded data.
+    void setLength(ALuint length, std::pair<uint64_t,uint64_t> loop_pts);
 
     bool isReady() const { return mLoadStatus == BufferLoadStatus::Ready; }
+    bool isLoaded() const { return mIsLoaded.load(std::memory_order_acquire); }
+
+    const SharedPtr<PendingBuffer> &getPendingLoad() const { return mPendingLoad; }
+    void setPendingLoad(SharedPtr<PendingBuffer> load) { mPendingLoad = std::move(load); }
+
+    void addBatch(SharedPtr<BufferBatch> batch) { mBatches.push_back(std::move(batch)); }
+    Vector<SharedPtr<BufferBatch>> takeBatches()
+    {
+        Vector<SharedPtr<BufferBatch>> batches;
+        batches.swap(mBatches);
+        return batches;
+    }
 
     ALuint getLength() const override final;
 
@@ -68,6 +146,8 @@ public:
     Vector<Source*> getSources() const override final { return mSources; }
 
     BufferLoadStatus getLoadStatus() override final;
+    bool waitUntilReady(ALuint msec) override final;
+    void waitUntilReady() override final;
 
     const String &getName() const override final { return mName; }
 
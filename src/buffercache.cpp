@@ -0,0 +1,170 @@
+#include "buffercache.h"
+
+#include <stdexcept>
+#include <cstring>
+
+
+namespace alure
+{
+
+// Keep the table at most 3/4 full, so probe sequences stay short.
+static inline bool NeedsGrowth(size_t count, size_t capacity)
+{ return count*4 > capacity*3; }
+
+
+size_t BufferCache::Hash(const char *name, size_t len)
+{
+    // FNV-1a
+    if(sizeof(size_t) > 4)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for(size_t i = 0;i < len;++i)
+        {
+            hash ^= static_cast<unsigned char>(name[i]);
+            hash *= 1099511628211ull;
+        }
+        return static_cast<size_t>(hash);
+    }
+
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0;i < len;++i)
+    {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+size_t BufferCache::findSlot(const char *name, size_t len, size_t hash) const
+{
+    const size_t mask = mEntries.size() - 1;
+    size_t idx = hash & mask;
+    while(mEntries[idx].mBuffer)
+    {
+        const Entry &entry = mEntries[idx];
+        if(entry.mHash == hash)
+        {
+            const String &bufname = entry.mBuffer->getName();
+            if(bufname.size() == len && memcmp(bufname.data(), name, len) == 0)
+                break;
+        }
+        idx = (idx+1) & mask;
+    }
+    return idx;
+}
+
+void BufferCache::rehash(size_t newcap)
+{
+    Vector<Entry> oldentries(newcap);
+    oldentries.swap(mEntries);
+
+    const size_t mask = mEntries.size() - 1;
+    for(Entry &entry : oldentries)
+    {
+        if(!entry.mBuffer) continue;
+        size_t idx = entry.mHash & mask;
+        while(mEntries[idx].mBuffer)
+            idx = (idx+1) & mask;
+        mEntries[idx] = std::move(entry);
+    }
+}
+
+
+void BufferCache::unlink(ALBuffer *buffer)
+{
+    if(buffer->mLruOlder) buffer->mLruOlder->mLruNewer = buffer->mLruNewer;
+    else mOldest = buffer->mLruNewer;
+    if(buffer->mLruNewer) buffer->mLruNewer->mLruOlder = buffer->mLruOlder;
+    else mNewest = buffer->mLruOlder;
+    buffer->mLruOlder = buffer->mLruNewer = nullptr;
+}
+
+void BufferCache::linkNewest(ALBuffer *buffer)
+{
+    buffer->mLruOlder = mNewest;
+    buffer->mLruNewer = nullptr;
+    if(mNewest) mNewest->mLruNewer = buffer;
+    else mOldest = buffer;
+    mNewest = buffer;
+    buffer->mLastUse = ++mUseCount;
+}
+
+
+ALBuffer *BufferCache::find(const char *name, size_t len, size_t hash) const
+{
+    if(mCount == 0) return nullptr;
+    return mEntries[findSlot(name, len, hash)].mBuffer.get();
+}
+
+ALBuffer *BufferCache::insert(UniquePtr<ALBuffer> buffer, uint64_t size)
+{
+    reserve(mCount+1);
+
+    const String &name = buffer->getName();
+    size_t hash = Hash(name);
+    Entry &entry = mEntries[findSlot(name.data(), name.size(), hash)];
+    if(entry.mBuffer)
+        throw std::runtime_error("Buffer \""+name+"\" already cached");
+
+    entry.mHash = hash;
+    entry.mBuffer = std::move(buffer);
+    ++mCount;
+
+    ALBuffer *ret = entry.mBuffer.get();
+    ret->mCacheSize = size;
+    mTotalSize += size;
+    linkNewest(ret);
+    return ret;
+}
+
+UniquePtr<ALBuffer> BufferCache::erase(const char *name, size_t len)
+{
+    UniquePtr<ALBuffer> ret;
+    if(mCount == 0) return ret;
+
+    const size_t mask = mEntries.size() - 1;
+    size_t idx = findSlot(name, len, Hash(name, len));
+    if(!mEntries[idx].mBuffer) return ret;
+
+    ret = std::move(mEntries[idx].mBuffer);
+    --mCount;
+    unlink(ret.get());
+    mTotalSize -= ret->mCacheSize;
+
+    // Shift back any following entries that would no longer be reachable
+    // through the now-empty slot.
+    size_t next = (idx+1) & mask;
+    while(mEntries[next].mBuffer)
+    {
+        size_t home = mEntries[next].mHash & mask;
+        if(((next-home)&mask) >= ((next-idx)&mask))
+        {
+            mEntries[idx] = std::move(mEntries[next]);
+            idx = next;
+        }
+        next = (next+1) & mask;
+    }
+
+    return ret;
+}
+
+void BufferCache::touch(ALBuffer *buffer)
+{
+    unlink(buffer);
+    linkNewest(buffer);
+}
+
+void BufferCache::reserve(size_t count)
+{
+    size_t capacity = mEntries.size();
+    if(capacity && !NeedsGrowth(count, capacity))
+        return;
+
+    if(!capacity) capacity = 16;
+    while(NeedsGrowth(count, capacity))
+        capacity <<= 1;
+    rehash(capacity);
+}
+
+} // namespace alure
@@ -0,0 +1,97 @@
+#ifndef BUFFERCACHE_H
+#define BUFFERCACHE_H
+
+#include "main.h"
+
+#include <cstring>
+
+#include "buffer.h"
+
+namespace alure {
+
+/* An open-addressing hash table of buffers keyed by name. Each slot keeps the
+ * name's hash alongside the buffer it owns, so probing only compares names on
+ * a full hash match, and lookups can be done with a plain character range
+ * without constructing a String. Buffers are heap-allocated, so the pointers
+ * handed out remain valid when the table grows.
+ *
+ * Linear probing is used with a power-of-two capacity, and removal shifts the
+ * following entries back instead of leaving tombstones.
+ *
+ * Buffers are also kept in a least-recently-used list along with their storage
+ * size, so the context can evict old buffers to stay within a memory budget.
+ */
+class BufferCache {
+    struct Entry {
+        size_t mHash;
+        UniquePtr<ALBuffer> mBuffer;
+    };
+    Vector<Entry> mEntries;
+    size_t mCount;
+
+    ALBuffer *mOldest, *mNewest;
+    uint64_t mTotalSize;
+    uint64_t mUseCount;
+
+    size_t findSlot(const char *name, size_t len, size_t hash) const;
+    void rehash(size_t newcap);
+
+    void unlink(ALBuffer *buffer);
+    void linkNewest(ALBuffer *buffer);
+
+public:
+    BufferCache()
+      : mCount(0), mOldest(nullptr), mNewest(nullptr), mTotalSize(0), mUseCount(0)
+    { }
+    BufferCache(const BufferCache&) = delete;
+    BufferCache& operator=(const BufferCache&) = delete;
+
+    static size_t Hash(const char *name, size_t len);
+    static size_t Hash(const String &name) { return Hash(name.data(), name.size()); }
+
+    /* Returns the buffer with the given name, or nullptr if not present. */
+    ALBuffer *find(const char *name, size_t len, size_t hash) const;
+    ALBuffer *find(const char *name, size_t len) const
+    { return find(name, len, Hash(name, len)); }
+    ALBuffer *find(const String &name) const
+    { return find(name.data(), name.size()); }
+
+    /* Takes ownership of a buffer whose name is not already in the cache, and
+     * returns it. `size' is the buffer's storage size in bytes. The buffer
+     * becomes the most recently used.
+     */
+    ALBuffer *insert(UniquePtr<ALBuffer> buffer, uint64_t size);
+
+    /* Removes the named buffer from the cache and returns it, or an empty
+     * pointer if not present.
+     */
+    UniquePtr<ALBuffer> erase(const char *name, size_t len);
+    UniquePtr<ALBuffer> erase(const String &name)
+    { return erase(name.data(), name.size()); }
+
+    /* Ensures `count' buffers can be held without growing the table. */
+    void reserve(size_t count);
+
+    size_t size() const { return mCount; }
+    bool empty() const { return mCount == 0; }
+
+    /* Marks the buffer as the most recently used. */
+    void touch(ALBuffer *buffer);
+
+    /* Walks the buffers from least to most recently used. */
+    ALBuffer *getOldest() const { return mOldest; }
+    static ALBuffer *getNewer(const ALBuffer *buffer) { return buffer->mLruNewer; }
+
+    /* Each use is stamped with an increasing count, so callers can tell which
+     * buffers were used after a given point.
+     */
+    uint64_t getUseCount() const { return mUseCount; }
+    static uint64_t getLastUse(const ALBuffer *buffer) { return buffer->mLastUse; }
+
+    /* Returns the total storage size of the cached buffers, in bytes. */
+    uint64_t getTotalSize() const { return mTotalSize; }
+};
+
+} // namespace alure
+
+#endif /* BUFFERCACHE_H */
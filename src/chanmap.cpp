@@ -0,0 +1,223 @@
+
+#include "config.h"
+
+#include "chanmap.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define HAVE_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+
+namespace alure
+{
+
+// Vorbis and Opus : FL, FC, FR, RL, RR, LFE
+// OpenAL          : FL, FR, FC, LFE, RL, RR
+static const ChannelMap VorbisX51Map{6, {0, 2, 1, 5, 3, 4}};
+// Vorbis and Opus : FL, FC, FR, SL, SR, RC, LFE
+// OpenAL          : FL, FR, FC, LFE, RC, SL, SR
+static const ChannelMap VorbisX61Map{7, {0, 2, 1, 6, 5, 3, 4}};
+// Vorbis and Opus : FL, FC, FR, SL, SR, RL, RR, LFE
+// OpenAL          : FL, FR, FC, LFE, RL, RR, SL, SR
+static const ChannelMap VorbisX71Map{8, {0, 2, 1, 7, 5, 6, 3, 4}};
+
+const ChannelMap *GetVorbisChannelMap(ChannelConfig chans)
+{
+    // 1, 2, and 4 channel files decode into the same channel order as OpenAL.
+    switch(chans)
+    {
+        case ChannelConfig::X51: return &VorbisX51Map;
+        case ChannelConfig::X61: return &VorbisX61Map;
+        case ChannelConfig::X71: return &VorbisX71Map;
+        default: break;
+    }
+    return nullptr;
+}
+
+
+/* Each kernel handles as many frames as it can from the start, and returns
+ * how many, leaving the rest to the scalar loop.
+ *
+ * Frames are processed one vector at a time, and for fewer than 8 channels a
+ * vector also covers the start of the next frame. The shuffle passes those
+ * samples through untouched, and the next frame is loaded after they're
+ * stored back, so this works in place. It does mean a vector's worth of
+ * samples must remain from the frame's start.
+ */
+template<typename T>
+static ALuint PermuteScalar(T *samples, ALuint frames, const ChannelMap &map)
+{
+    T frame[8];
+    for(ALuint i = 0;i < frames;++i)
+    {
+        std::copy(samples, samples+map.mChannels, frame);
+        for(ALuint c = 0;c < map.mChannels;++c)
+            samples[c] = frame[map.mOrder[c]];
+        samples += map.mChannels;
+    }
+    return frames;
+}
+
+// Builds a byte shuffle for one frame of the given sample size, within a
+// vector of the given size.
+static void MakeByteShuffle(ALubyte *shuffle, size_t vecsize, size_t samplesize, const ChannelMap &map)
+{
+    for(size_t i = 0;i < vecsize;++i)
+    {
+        size_t chan = i / samplesize;
+        if(chan < map.mChannels)
+            shuffle[i] = static_cast<ALubyte>(map.mOrder[chan]*samplesize + i%samplesize);
+        else
+            shuffle[i] = static_cast<ALubyte>(i);
+    }
+}
+
+#if defined(HAVE_X86_KERNELS)
+
+__attribute__((target("ssse3")))
+static ALuint PermuteInt16SSSE3(ALshort *samples, ALuint frames, const ChannelMap &map)
+{
+    alignas(16) ALubyte shuffle[16];
+    MakeByteShuffle(shuffle, 16, sizeof(ALshort), map);
+    const __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(shuffle));
+
+    ALuint i = 0;
+    for(;(frames-i)*map.mChannels >= 8;++i)
+    {
+        __m128i *frame = reinterpret_cast<__m128i*>(samples + i*map.mChannels);
+        _mm_storeu_si128(frame, _mm_shuffle_epi8(_mm_loadu_si128(frame), mask));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static ALuint PermuteInt16AVX2(ALshort *samples, ALuint frames, const ChannelMap &map)
+{
+    // Only 8-channel frames fit the per-lane shuffle, two at a time.
+    if(map.mChannels != 8)
+        return PermuteInt16SSSE3(samples, frames, map);
+
+    alignas(32) ALubyte shuffle[32];
+    MakeByteShuffle(shuffle, 16, sizeof(ALshort), map);
+    memcpy(shuffle+16, shuffle, 16);
+    const __m256i mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(shuffle));
+
+    ALuint i = 0;
+    for(;frames-i >= 2;i += 2)
+    {
+        __m256i *frame = reinterpret_cast<__m256i*>(samples + i*8);
+        _mm256_storeu_si256(frame, _mm256_shuffle_epi8(_mm256_loadu_si256(frame), mask));
+    }
+    return i + PermuteInt16SSSE3(samples + i*8, frames-i, map);
+}
+
+__attribute__((target("avx2")))
+static ALuint PermuteFloatAVX2(ALfloat *samples, ALuint frames, const ChannelMap &map)
+{
+    alignas(32) int order[8];
+    for(ALuint c = 0;c < 8;++c)
+        order[c] = (c < map.mChannels) ? map.mOrder[c] : c;
+    const __m256i idx = _mm256_load_si256(reinterpret_cast<const __m256i*>(order));
+
+    ALuint i = 0;
+    for(;(frames-i)*map.mChannels >= 8;++i)
+    {
+        ALfloat *frame = samples + i*map.mChannels;
+        _mm256_storeu_ps(frame, _mm256_permutevar8x32_ps(_mm256_loadu_ps(frame), idx));
+    }
+    return i;
+}
+
+#elif defined(HAVE_NEON_KERNELS)
+
+static ALuint PermuteInt16NEON(ALshort *samples, ALuint frames, const ChannelMap &map)
+{
+    ALubyte shuffle[16];
+    MakeByteShuffle(shuffle, 16, sizeof(ALshort), map);
+    const uint8x16_t mask = vld1q_u8(shuffle);
+
+    ALuint i = 0;
+    for(;(frames-i)*map.mChannels >= 8;++i)
+    {
+        uint8_t *frame = reinterpret_cast<uint8_t*>(samples + i*map.mChannels);
+        vst1q_u8(frame, vqtbl1q_u8(vld1q_u8(frame), mask));
+    }
+    return i;
+}
+
+static ALuint PermuteFloatNEON(ALfloat *samples, ALuint frames, const ChannelMap &map)
+{
+    ALubyte shuffle[32];
+    MakeByteShuffle(shuffle, 32, sizeof(ALfloat), map);
+    const uint8x16_t masklo = vld1q_u8(shuffle);
+    const uint8x16_t maskhi = vld1q_u8(shuffle+16);
+
+    ALuint i = 0;
+    for(;(frames-i)*map.mChannels >= 8;++i)
+    {
+        uint8_t *frame = reinterpret_cast<uint8_t*>(samples + i*map.mChannels);
+        uint8x16x2_t table = {{ vld1q_u8(frame), vld1q_u8(frame+16) }};
+        vst1q_u8(frame, vqtbl2q_u8(table, masklo));
+        vst1q_u8(frame+16, vqtbl2q_u8(table, maskhi));
+    }
+    return i;
+}
+
+#endif
+
+
+namespace {
+
+struct PermuteKernels {
+    ALuint (*mInt16)(ALshort*, ALuint, const ChannelMap&);
+    ALuint (*mFloat)(ALfloat*, ALuint, const ChannelMap&);
+};
+
+PermuteKernels SelectKernels()
+{
+    PermuteKernels kernels{PermuteScalar<ALshort>, PermuteScalar<ALfloat>};
+#if defined(HAVE_X86_KERNELS)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3"))
+        kernels.mInt16 = PermuteInt16SSSE3;
+    if(__builtin_cpu_supports("avx2"))
+    {
+        kernels.mInt16 = PermuteInt16AVX2;
+        kernels.mFloat = PermuteFloatAVX2;
+    }
+#elif defined(HAVE_NEON_KERNELS)
+    // NEON is always available on AArch64.
+    kernels.mInt16 = PermuteInt16NEON;
+    kernels.mFloat = PermuteFloatNEON;
+#endif
+    return kernels;
+}
+
+const PermuteKernels &GetKernels()
+{
+    static const PermuteKernels kernels = SelectKernels();
+    return kernels;
+}
+
+} // namespace
+
+void PermuteChannels(ALshort *samples, ALuint frames, const ChannelMap &map)
+{
+    ALuint done = GetKernels().mInt16(samples, frames, map);
+    PermuteScalar(samples + done*map.mChannels, frames-done, map);
+}
+
+void PermuteChannels(ALfloat *samples, ALuint frames, const ChannelMap &map)
+{
+    ALuint done = GetKernels().mFloat(samples, frames, map);
+    PermuteScalar(samples + done*map.mChannels, frames-done, map);
+}
+
+} // namespace alure
@@ -0,0 +1,29 @@
+#ifndef CHANMAP_H
+#define CHANMAP_H
+
+#include "main.h"
+
+namespace alure {
+
+/* A reordering of interleaved channels. Output channel i of each frame takes
+ * input channel mOrder[i].
+ */
+struct ChannelMap {
+    ALuint mChannels;
+    ALubyte mOrder[8];
+};
+
+/* Returns the map from Vorbis channel order (which Opus shares) to OpenAL's,
+ * or nullptr if the orders already match.
+ */
+const ChannelMap *GetVorbisChannelMap(ChannelConfig chans);
+
+/* Reorders the channels of each frame in place. Uses SIMD where the CPU
+ * supports it, as selected on first use.
+ */
+void PermuteChannels(ALshort *samples, ALuint frames, const ChannelMap &map);
+void PermuteChannels(ALfloat *samples, ALuint frames, const ChannelMap &map);
+
+} // namespace alure
+
+#endif /* CHANMAP_H */
@@ -12,6 +12,7 @@
 #include <fstream>
 #include <cstring>
 #include <map>
+#include <limits>
 #include <new>
 
 #include "alc.h"
@@ -36,9 +37,14 @@
 #include "devicemanager.h"
 #include "device.h"
 #include "buffer.h"
+#include "pcmcache.h"
+#include "soundbank.h"
 #include "source.h"
 #include "auxeffectslot.h"
 #include "effect.h"
+#include "memstream.h"
+#include "streamdecoder.h"
+#include "trace.h"
 #include <sourcegroup.h>
 
 namespace alure
@@ -68,13 +74,17 @@ static std::map<String,UniquePtr<DecoderFactory>> sDecoders;
 
 
 template<typename T>
-static SharedPtr<Decoder> GetDecoder(const String &name, UniquePtr<std::istream> &file, T start, T end)
+static SharedPtr<Decoder> GetDecoder(const String &name, UniquePtr<std::istream> &file, T start, T end, String &factoryname)
 {
     while(start != end)
     {
         DecoderFactory *factory = start->second.get();
         auto decoder = factory->createDecoder(file);
-        if(decoder) return decoder;
+        if(decoder)
+        {
+            factoryname = start->first;
+            return decoder;
+        }
 
         if(!file || !(file->clear(),file->seekg(0)))
             throw std::runtime_error("Failed to rewind "+name+" for the next decoder factory");
@@ -85,14 +95,96 @@ static SharedPtr<Decoder> GetDecoder(const String &name, UniquePtr<std::istream>
     return nullptr;
 }
 
-static SharedPtr<Decoder> GetDecoder(const String &name, UniquePtr<std::istream> file)
+SharedPtr<Decoder> GetDecoder(const String &name, UniquePtr<std::istream> file, String &factoryname)
 {
-    auto decoder = GetDecoder(name, file, sDecoders.begin(), sDecoders.end());
-    if(!decoder) decoder = GetDecoder(name, file, std::begin(sDefaultDecoders), std::end(sDefaultDecoders));
+    // Files from a sound bank say which decoder opened them when packed, so
+    // try that one before probing the rest.
+    if(const String *hint = GetDecoderHint(*file))
+    {
+        SharedPtr<Decoder> decoder;
+        auto iter = sDecoders.find(*hint);
+        if(iter != sDecoders.end())
+            decoder = GetDecoder(name, file, iter, std::next(iter), factoryname);
+        else
+        {
+            auto defiter = std::find_if(std::begin(sDefaultDecoders), std::end(sDefaultDecoders),
+                [hint](const std::pair<String,UniquePtr<DecoderFactory>> &entry) -> bool
+                { return entry.first == *hint; }
+            );
+            if(defiter != std::end(sDefaultDecoders))
+                decoder = GetDecoder(name, file, defiter, std::next(defiter), factoryname);
+        }
+        if(decoder) return decoder;
+    }
+
+    auto decoder = GetDecoder(name, file, sDecoders.begin(), sDecoders.end(), factoryname);
+    if(!decoder) decoder = GetDecoder(name, file, std::begin(sDefaultDecoders), std::end(sDefaultDecoders), factoryname);
     if(!decoder) throw std::runtime_error("No decoder for "+name);
     return decoder;
 }
 
+
+// The sample type preferred by the context currently creating a decoder on
+// this thread.
+static thread_local SampleType sPreferredType = SampleType::Int16;
+
+SampleType GetPreferredSampleType()
+{
+    return sPreferredType;
+}
+
+namespace {
+
+class PreferredTypeScope {
+    SampleType mOldType;
+
+public:
+    PreferredTypeScope(SampleType type) : mOldType(sPreferredType)
+    { sPreferredType = type; }
+    PreferredTypeScope(const PreferredTypeScope&) = delete;
+    PreferredTypeScope& operator=(const PreferredTypeScope&) = delete;
+    ~PreferredTypeScope() { sPreferredType = mOldType; }
+};
+
+} // namespace
+
+
+// Wraps a decoder to time its reads, adding to the counters for its type.
+class CountedDecoder : public Decoder {
+    SharedPtr<Decoder> mDecoder;
+    SharedPtr<DecoderCounters> mCounters;
+
+public:
+    CountedDecoder(SharedPtr<Decoder> decoder, SharedPtr<DecoderCounters> counters)
+      : mDecoder(std::move(decoder)), mCounters(std::move(counters))
+    { }
+
+    ALuint getFrequency() const override final { return mDecoder->getFrequency(); }
+    ChannelConfig getChannelConfig() const override final { return mDecoder->getChannelConfig(); }
+    SampleType getSampleType() const override final { return mDecoder->getSampleType(); }
+
+    uint64_t getLength() const override final { return mDecoder->getLength(); }
+    uint64_t getPosition() const override final { return mDecoder->getPosition(); }
+    bool seek(uint64_t pos) override final { return mDecoder->seek(pos); }
+
+    std::pair<uint64_t,uint64_t> getLoopPoints() const override final
+    { return mDecoder->getLoopPoints(); }
+
+    ALuint read(ALvoid *ptr, ALuint count) override final
+    {
+        ALURE_TRACE_ZONE("Decoder::read");
+        auto start = std::chrono::steady_clock::now();
+        ALuint got = mDecoder->read(ptr, count);
+        StatCounters::add(mCounters->mDecodeTime,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start
+            ).count()
+        );
+        StatCounters::add(mCounters->mFrames, got);
+        return got;
+    }
+};
+
 void RegisterDecoder(const String &name, UniquePtr<DecoderFactory> factory)
 {
     while(sDecoders.find(name) != sDecoders.end())
@@ -115,11 +207,7 @@ UniquePtr<DecoderFactory> UnregisterDecoder(const String &name)
 
 class DefaultFileIOFactory : public FileIOFactory {
     UniquePtr<std::istream> openFile(const String &name) override final
-    {
-        auto file = MakeUnique<std::ifstream>(name.c_str(), std::ios::binary);
-        if(!file->is_open()) file = nullptr;
-        return std::move(file);
-    }
+    { return OpenMappedFile(name); }
 };
 static DefaultFileIOFactory sDefaultFileFactory;
 
@@ -160,6 +248,24 @@ String MessageHandler::resourceNotFound(const String&)
     return String();
 }
 
+void MessageHandler::bufferEvicted(const String&)
+{
+}
+
+
+// Favors louder sources, and those with more than a second left to play.
+static inline ALfloat DefaultVoiceScore(ALfloat gain, ALfloat remaining)
+{ return gain * std::min(remaining, 1.0f); }
+
+VoiceScorer::~VoiceScorer()
+{
+}
+
+ALfloat VoiceScorer::getScore(Source*, ALfloat gain, ALfloat remaining)
+{
+    return DefaultVoiceScore(gain, remaining);
+}
+
 
 template<typename T>
 static inline void LoadALFunc(T **func, const char *name)
@@ -295,6 +401,10 @@ void ALContext::setupExts()
                                    alIsExtensionPresent(entry.name);
         if(mHasExt[entry.extension]) entry.loader(this);
     }
+
+    // This is the first time the context is current, so sources can be made.
+    if(mInitialSources > 0)
+        genSourceIds(mInitialSources);
 }
 
 
@@ -303,51 +413,80 @@ void ALContext::backgroundProc()
     if(ALDeviceManager::SetThreadContext && mDevice->hasExtension(EXT_thread_local_context))
         ALDeviceManager::SetThreadContext(getContext());
 
-    std::chrono::steady_clock::time_point basetime = std::chrono::steady_clock::now();
-    std::chrono::milliseconds waketime(0);
+    // Buffers are only processed as the device mixes, so don't come back
+    // sooner than one update period.
+    ALCint refresh = 0;
+    alcGetIntegerv(alcGetContextsDevice(getContext()), ALC_REFRESH, 1, &refresh);
+    if(refresh <= 0) refresh = 50;
+    const std::chrono::nanoseconds mindelay(1000000000 / refresh);
+
+    Vector<ALSource*> starved;
     std::unique_lock<std::mutex> ctxlock(mContextMutex);
     while(!mQuitThread.load(std::memory_order_acquire))
     {
+        auto now = std::chrono::steady_clock::now();
+        auto waketime = std::chrono::steady_clock::time_point::max();
         {
+            ALURE_TRACE_ZONE("ALContext::backgroundProc");
             std::lock_guard<std::mutex> srclock(mSourceStreamMutex);
-            auto source = mStreamingSources.begin();
-            while(source != mStreamingSources.end())
+
+            // Only the streams that are due get touched, instead of querying
+            // every source each time.
+            starved.swap(mStarvedStreams);
+            for(ALSource *source : starved)
             {
-                if(!(*source)->updateAsync())
-                    source = mStreamingSources.erase(source);
-                else
-                    ++source;
+                if(isStreamingNoLock(source) &&
+                   source->getStreamDeadline() == std::chrono::steady_clock::time_point::min())
+                    updateStream(source, now, mindelay);
             }
+            starved.clear();
+
+            while(!mStreamQueue.empty() && mStreamQueue.top().mTime <= now)
+            {
+                StreamDeadline entry = mStreamQueue.top();
+                mStreamQueue.pop();
+                if(isStreamingNoLock(entry.mSource) &&
+                   entry.mSource->getStreamDeadline() == entry.mTime)
+                    updateStream(entry.mSource, now, mindelay);
+            }
+
+            if(!mStreamQueue.empty())
+                waketime = mStreamQueue.top().mTime;
+            // The decode threads wake this thread when a starved stream gets
+            // more data, but check back anyway in case that was missed.
+            if(!mStarvedStreams.empty())
+                waketime = std::min(waketime, now + mindelay);
         }
 
-        // Only do one pending buffer at a time. In case there's several large
-        // buffers to load, we still need to process streaming sources so they
-        // don't underrun.
-        RingBuffer::Data ringdata = mPendingBuffers.get_read_vector()[0];
-        if(ringdata.len > 0)
+        // Upload any buffers the decode threads have finished with. The
+        // decoding itself happens elsewhere, so streaming sources don't have
+        // to wait on large buffers.
+        Vector<SharedPtr<PendingBuffer>> decoded;
         {
-            PendingBuffer *pb = reinterpret_cast<PendingBuffer*>(ringdata.buf);
-            pb->mBuffer->load(pb->mFrames, pb->mFormat, pb->mDecoder, pb->mName, this);
-            pb->~PendingBuffer();
-            mPendingBuffers.read_advance(1);
-            continue;
+            std::lock_guard<std::mutex> wakelock(mWakeMutex);
+            decoded.swap(mDecodedBuffers);
         }
+        for(auto &pb : decoded)
+            finishLoad(pb.get());
+        decoded.clear();
+        StatCounters::add(mStats.mBackgroundTime,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - now
+            ).count()
+        );
 
         std::unique_lock<std::mutex> wakelock(mWakeMutex);
-        if(!mQuitThread.load(std::memory_order_acquire) && mPendingBuffers.read_space() == 0)
+        if(!mQuitThread.load(std::memory_order_acquire) && mDecodedBuffers.empty())
         {
             ctxlock.unlock();
 
             ALuint interval = mWakeInterval.load();
-            if(!interval)
+            if(interval)
+                waketime = std::min(waketime, now + std::chrono::milliseconds(interval));
+            if(waketime == std::chrono::steady_clock::time_point::max())
                 mWakeThread.wait(wakelock);
             else
-            {
-                auto now = std::chrono::steady_clock::now() - basetime;
-                auto duration = std::chrono::milliseconds(interval);
-                while((waketime - now).count() <= 0) waketime += duration;
-                mWakeThread.wait_until(wakelock, waketime + basetime);
-            }
+                mWakeThread.wait_until(wakelock, waketime);
             wakelock.unlock();
 
             ctxlock.lock();
@@ -362,11 +501,240 @@ void ALContext::backgroundProc()
         ALDeviceManager::SetThreadContext(nullptr);
 }
 
+bool ALContext::isStreamingNoLock(ALSource *source) const
+{
+    return std::binary_search(mStreamingSources.begin(), mStreamingSources.end(), source);
+}
+
+void ALContext::updateStream(ALSource *source, std::chrono::steady_clock::time_point now,
+                             std::chrono::nanoseconds mindelay)
+{
+    std::chrono::nanoseconds delay;
+    if(!source->updateAsync(delay))
+        removeStreamNoLock(source);
+    else if(delay.count() < 0)
+    {
+        source->setStreamDeadline(std::chrono::steady_clock::time_point::min());
+        mStarvedStreams.push_back(source);
+    }
+    else if(delay == std::chrono::nanoseconds::max())
+        source->setStreamDeadline(std::chrono::steady_clock::time_point::max());
+    else
+    {
+        StreamDeadline entry{now + std::max(delay, mindelay), source};
+        source->setStreamDeadline(entry.mTime);
+        mStreamQueue.push(entry);
+    }
+}
+
+
+void ALContext::decodeProc()
+{
+    std::unique_lock<std::mutex> lock(mPendingMutex);
+    while(!mQuitThread.load(std::memory_order_acquire))
+    {
+        // Streams are about to be played, so they take precedence over
+        // buffers.
+        if(!mPendingStreams.empty())
+        {
+            SharedPtr<StreamDecoder> stream = std::move(mPendingStreams.front());
+            mPendingStreams.pop_front();
+            lock.unlock();
+
+            // If the stream ran dry, wake the background thread so it can
+            // queue the new data as soon as possible.
+            if(stream->process())
+            {
+                mWakeMutex.lock();
+                mWakeMutex.unlock();
+                mWakeThread.notify_all();
+            }
+            stream = nullptr;
+
+            lock.lock();
+            continue;
+        }
+        UniquePtr<PendingLoad> load = popPendingLoad();
+        if(!load)
+        {
+            if(hasPendingLoads())
+            {
+                // A buffer is still being added, which only takes a moment.
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+                continue;
+            }
+
+            // Let submitters know to wake us, then check again in case
+            // something was added before they could see it.
+            mPendingWaiters.fetch_add(1, std::memory_order_seq_cst);
+            if(!hasPendingLoads() && mPendingStreams.empty() &&
+               !mQuitThread.load(std::memory_order_acquire))
+                mPendingCond.wait(lock);
+            mPendingWaiters.fetch_sub(1, std::memory_order_seq_cst);
+            continue;
+        }
+        lock.unlock();
+
+        // Skip loads that were already taken, from an earlier queue entry or
+        // by the app asking for the buffer.
+        SharedPtr<PendingBuffer> pb = std::move(load->mJob);
+        load = nullptr;
+        if(!pb->claim())
+        {
+            pb = nullptr;
+            lock.lock();
+            continue;
+        }
+        mStats.mPendingLoads.fetch_sub(1, std::memory_order_relaxed);
+
+        pb->mBuffer->decode(pb->mFrames, pb->mDecoder.get(), pb->mData, pb->mLoopPts);
+        // Done with the decoder, so close the file now.
+        pb->mDecoder = nullptr;
+
+        // Hand it off to the background thread to upload.
+        mWakeMutex.lock();
+        mDecodedBuffers.push_back(std::move(pb));
+        mWakeMutex.unlock();
+        mWakeThread.notify_all();
+
+        lock.lock();
+    }
+}
+
+void ALContext::startAsyncThreads()
+{
+    if(mThread.get_id() == std::thread::id())
+        mThread = std::thread(std::mem_fn(&ALContext::backgroundProc), this);
+    if(mDecodeThreads.empty())
+    {
+        ALuint count = mDecodeThreadCount.load();
+        if(!count)
+        {
+            count = std::thread::hardware_concurrency();
+            count = (count > 1) ? count-1 : 1;
+        }
+        mDecodeThreads.reserve(count);
+        while(mDecodeThreads.size() < count)
+            mDecodeThreads.emplace_back(std::mem_fn(&ALContext::decodeProc), this);
+    }
+}
+
+void ALContext::queueLoad(SharedPtr<PendingBuffer> job, LoadPriority priority)
+{
+    auto load = MakeUnique<PendingLoad>();
+    load->mJob = std::move(job);
+    mPendingBuffers[static_cast<size_t>(priority)].push(std::move(load));
+}
 
-ALContext::ALContext(ALCcontext *context, ALDevice *device)
-  : mContext(context), mDevice(device), mRefs(0),
-    mHasExt{false}, mPendingBuffers(16, sizeof(PendingBuffer)),
-    mWakeInterval(0), mQuitThread(false), mIsConnected(true), mIsBatching(false),
+UniquePtr<ALContext::PendingLoad> ALContext::popPendingLoad()
+{
+    // Highest priority first
+    UniquePtr<PendingLoad> load;
+    for(size_t i = sizeof(mPendingBuffers)/sizeof(mPendingBuffers[0]);i > 0 && !load;--i)
+        load = mPendingBuffers[i-1].pop();
+    return load;
+}
+
+bool ALContext::hasPendingLoads() const
+{
+    for(const auto &queue : mPendingBuffers)
+    {
+        if(!queue.empty())
+            return true;
+    }
+    return false;
+}
+
+void ALContext::raiseLoadPriority(ALBuffer *buffer, LoadPriority priority)
+{
+    // Queue it again at the higher priority. Whichever entry is reached first
+    // gets it, and the other is skipped.
+    const SharedPtr<PendingBuffer> &job = buffer->getPendingLoad();
+    if(job && priority > job->mPriority && !job->isClaimed())
+    {
+        job->mPriority = priority;
+        queueLoad(job, priority);
+        wakeDecodeThreads(1);
+    }
+}
+
+void ALContext::waitForLoad(ALBuffer *buffer)
+{
+    raiseLoadPriority(buffer, LoadPriority::Critical);
+    std::unique_lock<std::mutex> lock(mLoadMutex);
+    while(!buffer->isLoaded())
+        mLoadCond.wait(lock);
+}
+
+bool ALContext::waitForLoad(ALBuffer *buffer, std::chrono::milliseconds timeout)
+{
+    raiseLoadPriority(buffer, LoadPriority::Critical);
+    std::unique_lock<std::mutex> lock(mLoadMutex);
+    return mLoadCond.wait_for(lock, timeout, [buffer]() -> bool { return buffer->isLoaded(); });
+}
+
+void ALContext::wakeDecodeThreads(size_t count)
+{
+    // Busy decode threads will get to new buffers on their own, so this only
+    // needs to lock when some are asleep.
+    if(mPendingWaiters.load(std::memory_order_seq_cst) > 0)
+    {
+        mPendingMutex.lock();
+        mPendingMutex.unlock();
+        if(count > 1)
+            mPendingCond.notify_all();
+        else
+            mPendingCond.notify_one();
+    }
+}
+
+void ALContext::addStreamDecode(SharedPtr<StreamDecoder> stream)
+{
+    if(isRenderDriven())
+    {
+        // Decode right away, so the result doesn't depend on the decode
+        // threads keeping up.
+        stream->process();
+        return;
+    }
+    mPendingMutex.lock();
+    mPendingStreams.push_back(std::move(stream));
+    mPendingMutex.unlock();
+    mPendingCond.notify_one();
+}
+
+void ALContext::finishBatches(ALBuffer *buffer)
+{
+    std::lock_guard<std::mutex> lock(mBatchMutex);
+    for(auto &batch : buffer->takeBatches())
+    {
+        if(--batch->mRemaining == 0)
+            batch->mPromise.set_value(batch->mBuffers);
+    }
+}
+
+void ALContext::finishLoad(PendingBuffer *pb)
+{
+    pb->mBuffer->load(pb->mFormat, pb->mData, pb->mLoopPts, this);
+    finishBatches(pb->mBuffer);
+    // The buffer may hold on to the job until the app sees it's ready, so
+    // don't keep the samples around that long.
+    Vector<ALbyte>().swap(pb->mData);
+
+    // Other threads may be waiting on this buffer, whichever thread loaded
+    // it.
+    mLoadMutex.lock(); mLoadMutex.unlock();
+    mLoadCond.notify_all();
+}
+
+
+ALContext::ALContext(ALCcontext *context, ALDevice *device, ALuint initsources)
+  : mContext(context), mInitialSources(initsources), mDevice(device), mMaxVoices(0), mVoiceCullGain(0.0f), mVoiceScoresStale(true),
+    mListenerPosition(0.0f), mDistanceModel(DistanceModel::InverseClamped), mBufferBudget(0), mRefs(0),
+    mHasExt{false}, mPendingWaiters(0), mDecodeThreadCount(0), mWakeInterval(0), mPreferredType(SampleType::Int16), mQuitThread(false), mIsConnected(true), mIsBatching(false),
+    mALCalls(0), mUpdateALCalls(0), mVirtualSources(0),
     alGetSourcei64vSOFT(0),
     alGenEffects(0), alDeleteEffects(0), alIsEffect(0),
     alEffecti(0), alEffectiv(0), alEffectf(0), alEffectfv(0),
@@ -382,18 +750,6 @@ ALContext::ALContext(ALCcontext *context, ALDevice *device)
 
 ALContext::~ALContext()
 {
-    auto ringdata = mPendingBuffers.get_read_vector();
-    if(ringdata[0].len > 0)
-    {
-        PendingBuffer *pb = reinterpret_cast<PendingBuffer*>(ringdata[0].buf);
-        for(size_t i = 0;i < ringdata[0].len;i++)
-            pb[i].~PendingBuffer();
-        pb = reinterpret_cast<PendingBuffer*>(ringdata[1].buf);
-        for(size_t i = 0;i < ringdata[1].len;i++)
-            pb[i].~PendingBuffer();
-
-        mPendingBuffers.read_advance(ringdata[0].len + ringdata[1].len);
-    }
 }
 
 
@@ -417,6 +773,16 @@ void ALContext::destroy()
         mWakeThread.notify_all();
         mThread.join();
     }
+    if(!mDecodeThreads.empty())
+    {
+        std::unique_lock<std::mutex> lock(mPendingMutex);
+        mQuitThread.store(true, std::memory_order_release);
+        lock.unlock();
+        mPendingCond.notify_all();
+        for(auto &thrd : mDecodeThreads)
+            thrd.join();
+        mDecodeThreads.clear();
+    }
 
     alcDestroyContext(mContext);
     mContext = nullptr;
@@ -428,12 +794,15 @@ void ALContext::destroy()
 void ALContext::startBatch()
 {
     alcSuspendContext(mContext);
+    addALCalls(1);
     mIsBatching = true;
 }
 
 void ALContext::endBatch()
 {
+    commitSources();
     alcProcessContext(mContext);
+    addALCalls(1);
     mIsBatching = false;
 }
 
@@ -465,23 +834,126 @@ ALuint ALContext::getAsyncWakeInterval() const
 }
 
 
+void ALContext::setAsyncDecodeThreads(ALuint count)
+{
+    if(!mDecodeThreads.empty())
+        throw std::runtime_error("Decode threads already started");
+    mDecodeThreadCount.store(count);
+}
+
+ALuint ALContext::getAsyncDecodeThreads() const
+{
+    return mDecodeThreadCount.load();
+}
+
+
+void ALContext::setBufferCacheBudget(uint64_t bytes)
+{
+    mBufferBudget.store(bytes);
+}
+
+uint64_t ALContext::getBufferCacheBudget() const
+{
+    return mBufferBudget.load();
+}
+
+
+void ALContext::setPreferredSampleType(SampleType type)
+{
+    if(type != SampleType::Int16 && type != SampleType::Float32)
+        throw std::runtime_error("Unsupported preferred sample type");
+    mPreferredType.store(type);
+}
+
+SampleType ALContext::getPreferredSampleType() const
+{
+    return mPreferredType.load();
+}
+
+
+void ALContext::setDecodeCacheDirectory(const String &path)
+{
+    std::lock_guard<std::mutex> lock(mDecodeCacheMutex);
+    mDecodeCacheDir = path;
+}
+
+String ALContext::getDecodeCacheDirectory() const
+{
+    std::lock_guard<std::mutex> lock(mDecodeCacheMutex);
+    return mDecodeCacheDir;
+}
+
+void ALContext::evictBuffers(uint64_t needed, uint64_t protect)
+{
+    uint64_t budget = mBufferBudget.load();
+    if(!budget) return;
+
+    // Buffers used at or after the 'protect' count are newer than anything
+    // that may be evicted, so stop there.
+    ALBuffer *buffer = mBuffers.getOldest();
+    while(buffer && mBuffers.getTotalSize()+needed > budget &&
+          BufferCache::getLastUse(buffer) < protect)
+    {
+        ALBuffer *next = BufferCache::getNewer(buffer);
+        if(buffer->isLoaded() && !buffer->isInUse())
+        {
+            String name = buffer->getName();
+            buffer->cleanup();
+            mBuffers.erase(name);
+            send(&MessageHandler::bufferEvicted, name);
+        }
+        buffer = next;
+    }
+}
+
+
+SharedPtr<DecoderCounters> ALContext::getDecoderCounters(const String &name)
+{
+    std::lock_guard<std::mutex> lock(mDecoderStatsMutex);
+    auto &counters = mDecoderStats[name];
+    if(!counters) counters = MakeShared<DecoderCounters>();
+    return counters;
+}
+
 SharedPtr<Decoder> ALContext::createDecoder(const String &name)
 {
-    auto file = FileIOFactory::get().openFile(name);
-    if(file) return GetDecoder(name, std::move(file));
+    SampleType type = mPreferredType.load();
+    if(type == SampleType::Float32 && !hasExtension(EXT_FLOAT32))
+        type = SampleType::Int16;
+    PreferredTypeScope typescope(type);
 
-    // Resource not found. Try to find a substitute.
-    if(!mMessage.get()) throw std::runtime_error("Failed to open "+name);
     String oldname = name;
-    do {
-        String newname(mMessage->resourceNotFound(oldname));
-        if(newname.empty())
-            throw std::runtime_error("Failed to open "+oldname);
-        file = FileIOFactory::get().openFile(newname);
-        oldname = std::move(newname);
-    } while(!file);
+    auto file = FileIOFactory::get().openFile(name);
+    if(!file)
+    {
+        // Resource not found. Try to find a substitute.
+        if(!mMessage.get()) throw std::runtime_error("Failed to open "+name);
+        do {
+            String newname(mMessage->resourceNotFound(oldname));
+            if(newname.empty())
+                throw std::runtime_error("Failed to open "+oldname);
+            file = FileIOFactory::get().openFile(newname);
+            oldname = std::move(newname);
+        } while(!file);
+    }
 
-    return GetDecoder(oldname, std::move(file));
+    // The decoder owns the file once it's opened, but the cache entry still
+    // needs to look at it.
+    std::istream &stream = *file;
+    String factoryname;
+    auto decoder = GetDecoder(oldname, std::move(file), factoryname);
+
+    // WAV files are PCM already, so only cache what takes decoding.
+    String cachedir = getDecodeCacheDirectory();
+    if(cachedir.empty() || factoryname == "_alure_int_wave")
+        return MakeShared<CountedDecoder>(std::move(decoder), getDecoderCounters(factoryname));
+
+    PCMCacheEntry entry(cachedir, oldname, stream, type);
+    if(auto cached = OpenPCMCache(entry))
+        return MakeShared<CountedDecoder>(std::move(cached), getDecoderCounters("_alure_int_pcmcache"));
+
+    decoder = MakePCMCacheWriter(std::move(decoder), std::move(entry));
+    return MakeShared<CountedDecoder>(std::move(decoder), getDecoderCounters(factoryname));
 }
 
 
@@ -493,23 +965,35 @@ bool ALContext::isSupported(ChannelConfig channels, SampleType type) const
 
 Buffer *ALContext::getBuffer(const String &name)
 {
+    ALURE_TRACE_ZONE("ALContext::getBuffer");
     CheckContext(this);
 
-    auto hasher = std::hash<String>();
-    auto iter = std::lower_bound(mBuffers.begin(), mBuffers.end(), hasher(name),
-        [hasher](const UniquePtr<ALBuffer> &lhs, size_t rhs) -> bool
-        { return hasher(lhs->getName()) < rhs; }
-    );
-    if(iter != mBuffers.end() && (*iter)->getName() == name)
+    if(ALBuffer *buffer = mBuffers.find(name))
     {
+        StatCounters::add(mStats.mCacheHits, 1);
         // Ensure the buffer is loaded before returning. getBuffer guarantees
-        // the returned buffer is loaded.
-        ALBuffer *buffer = iter->get();
-        while(buffer->getLoadStatus() == BufferLoadStatus::Pending)
-            std::this_thread::yield();
+        // the returned buffer is loaded. If no decode thread has started on
+        // it, do it here rather than wait behind everything else queued.
+        if(buffer->getLoadStatus() == BufferLoadStatus::Pending)
+        {
+            SharedPtr<PendingBuffer> pb = buffer->getPendingLoad();
+            if(pb && pb->claim())
+            {
+                mStats.mPendingLoads.fetch_sub(1, std::memory_order_relaxed);
+                buffer->decode(pb->mFrames, pb->mDecoder.get(), pb->mData, pb->mLoopPts);
+                pb->mDecoder = nullptr;
+                finishLoad(pb.get());
+            }
+        }
+        if(buffer->getLoadStatus() == BufferLoadStatus::Pending)
+        {
+            waitForLoad(buffer);
+            buffer->getLoadStatus();
+        }
+        mBuffers.touch(buffer);
         return buffer;
     }
-    // NOTE: 'iter' is used later to insert a new entry!
+    StatCounters::add(mStats.mCacheMisses, 1);
 
     auto decoder = createDecoder(name);
 
@@ -545,6 +1029,8 @@ Buffer *ALContext::getBuffer(const String &name)
     if(mMessage.get())
         mMessage->bufferLoading(name, chans, type, srate, data);
 
+    evictBuffers(data.size(), mBuffers.getUseCount()+1);
+
     alGetError();
     ALuint bid = 0;
     try {
@@ -558,9 +1044,9 @@ Buffer *ALContext::getBuffer(const String &name)
         if(alGetError() != AL_NO_ERROR)
             throw std::runtime_error("Failed to buffer data");
 
-        return mBuffers.insert(iter,
-            MakeUnique<ALBuffer>(this, bid, srate, chans, type, true, name)
-        )->get();
+        auto buffer = MakeUnique<ALBuffer>(this, bid, srate, chans, type, true, name);
+        buffer->setLength(frames, loop_pts);
+        return mBuffers.insert(std::move(buffer), data.size());
     }
     catch(...) {
         alDeleteBuffers(1, &bid);
@@ -568,18 +1054,18 @@ Buffer *ALContext::getBuffer(const String &name)
     }
 }
 
-Buffer *ALContext::getBufferAsync(const String &name)
+Buffer *ALContext::getBufferAsync(const String &name, LoadPriority priority)
 {
     CheckContext(this);
 
-    auto hasher = std::hash<String>();
-    auto iter = std::lower_bound(mBuffers.begin(), mBuffers.end(), hasher(name),
-        [hasher](const UniquePtr<ALBuffer> &lhs, size_t rhs) -> bool
-        { return hasher(lhs->getName()) < rhs; }
-    );
-    if(iter != mBuffers.end() && (*iter)->getName() == name)
-        return iter->get();
-    // NOTE: 'iter' is used later to insert a new entry!
+    if(ALBuffer *buffer = mBuffers.find(name))
+    {
+        StatCounters::add(mStats.mCacheHits, 1);
+        raiseLoadPriority(buffer, priority);
+        mBuffers.touch(buffer);
+        return buffer;
+    }
+    StatCounters::add(mStats.mCacheMisses, 1);
 
     auto decoder = createDecoder(name);
 
@@ -597,6 +1083,9 @@ Buffer *ALContext::getBufferAsync(const String &name)
         throw std::runtime_error(sstr.str());
     }
 
+    uint64_t size = FramesToBytes(frames, chans, type);
+    evictBuffers(size, mBuffers.getUseCount()+1);
+
     alGetError();
     ALuint bid = 0;
     alGenBuffers(1, &bid);
@@ -605,34 +1094,180 @@ Buffer *ALContext::getBufferAsync(const String &name)
 
     auto buffer = MakeUnique<ALBuffer>(this, bid, srate, chans, type, false, name);
 
-    if(mThread.get_id() == std::thread::id())
-        mThread = std::thread(std::mem_fn(&ALContext::backgroundProc), this);
+    startAsyncThreads();
 
-    while(mPendingBuffers.write_space() == 0)
-        std::this_thread::yield();
+    auto pb = MakeShared<PendingBuffer>();
+    pb->mBuffer = buffer.get();
+    pb->mDecoder = decoder;
+    pb->mFormat = format;
+    pb->mFrames = frames;
+    pb->mPriority = priority;
+    buffer->setPendingLoad(pb);
 
-    RingBuffer::Data ringdata = mPendingBuffers.get_write_vector()[0];
-    new(ringdata.buf) PendingBuffer{name, buffer.get(), decoder, format, frames};
-    mPendingBuffers.write_advance(1);
-    mWakeMutex.lock(); mWakeMutex.unlock();
-    mWakeThread.notify_all();
+    mStats.mPendingLoads.fetch_add(1, std::memory_order_relaxed);
+    queueLoad(std::move(pb), priority);
+    wakeDecodeThreads(1);
 
-    return mBuffers.insert(iter, std::move(buffer))->get();
+    return mBuffers.insert(std::move(buffer), size);
 }
 
 
-void ALContext::removeBuffer(const String &name)
+SharedFuture<Vector<Buffer*>> ALContext::getBuffersAsync(const Vector<String> &names, LoadPriority priority)
 {
     CheckContext(this);
-    auto hasher = std::hash<String>();
-    auto iter = std::lower_bound(mBuffers.begin(), mBuffers.end(), hasher(name),
-        [hasher](const UniquePtr<ALBuffer> &lhs, size_t rhs) -> bool
-        { return hasher(lhs->getName()) < rhs; }
+
+    auto batch = MakeShared<BufferBatch>();
+    batch->mBuffers.resize(names.size());
+
+    // Find the names already in the cache, and collect the rest sorted by
+    // hash so repeated names end up next to each other.
+    Vector<std::pair<size_t,size_t>> missing;
+    uint64_t startuse = mBuffers.getUseCount();
+    for(size_t i = 0;i < names.size();++i)
+    {
+        const String &name = names[i];
+        size_t hash = BufferCache::Hash(name);
+        if(ALBuffer *buffer = mBuffers.find(name.data(), name.size(), hash))
+        {
+            raiseLoadPriority(buffer, priority);
+            mBuffers.touch(buffer);
+            batch->mBuffers[i] = buffer;
+        }
+        else
+            missing.emplace_back(hash, i);
+    }
+    StatCounters::add(mStats.mCacheHits, names.size() - missing.size());
+    StatCounters::add(mStats.mCacheMisses, missing.size());
+    std::sort(missing.begin(), missing.end(),
+        [&names](const std::pair<size_t,size_t> &lhs, const std::pair<size_t,size_t> &rhs) -> bool
+        {
+            if(lhs.first != rhs.first) return lhs.first < rhs.first;
+            return names[lhs.second] < names[rhs.second];
+        }
     );
-    if(iter != mBuffers.end() && (*iter)->getName() == name)
+    auto is_dup = [&names, &missing](size_t i) -> bool
+    {
+        return i > 0 && missing[i-1].first == missing[i].first &&
+               names[missing[i-1].second] == names[missing[i].second];
+    };
+
+    // Open all the new names before creating anything, so a failure leaves
+    // the cache untouched.
+    Vector<SharedPtr<PendingBuffer>> pending;
+    uint64_t needed = 0;
+    for(size_t i = 0;i < missing.size();++i)
     {
-        (*iter)->cleanup();
-        mBuffers.erase(iter);
+        if(is_dup(i)) continue;
+
+        auto decoder = createDecoder(names[missing[i].second]);
+        ChannelConfig chans = decoder->getChannelConfig();
+        SampleType type = decoder->getSampleType();
+        ALuint frames = decoder->getLength();
+        if(!frames) throw std::runtime_error("No samples for buffer");
+
+        ALenum format = GetFormat(chans, type);
+        if(format == AL_NONE)
+        {
+            std::stringstream sstr;
+            sstr<< "Format not supported ("<<GetSampleTypeName(type)<<", "<<GetChannelConfigName(chans)<<")";
+            throw std::runtime_error(sstr.str());
+        }
+
+        needed += FramesToBytes(frames, chans, type);
+
+        auto pb = MakeShared<PendingBuffer>();
+        pb->mDecoder = decoder;
+        pb->mFormat = format;
+        pb->mFrames = frames;
+        pb->mPriority = priority;
+        pending.push_back(std::move(pb));
+    }
+
+    if(!pending.empty())
+    {
+        // Don't evict anything requested in this batch.
+        evictBuffers(needed, startuse+1);
+
+        Vector<ALuint> bids(pending.size());
+        alGetError();
+        alGenBuffers(bids.size(), bids.data());
+        if(alGetError() != AL_NO_ERROR)
+            throw std::runtime_error("Failed to buffer data");
+
+        Vector<UniquePtr<ALBuffer>> newbufs;
+        try {
+            newbufs.reserve(pending.size());
+            mBuffers.reserve(mBuffers.size() + pending.size());
+            for(size_t i = 0;i < missing.size();++i)
+            {
+                if(!is_dup(i))
+                {
+                    PendingBuffer *pb = pending[newbufs.size()].get();
+                    Decoder *decoder = pb->mDecoder.get();
+                    newbufs.emplace_back(MakeUnique<ALBuffer>(this, bids[newbufs.size()],
+                        decoder->getFrequency(), decoder->getChannelConfig(),
+                        decoder->getSampleType(), false, names[missing[i].second]
+                    ));
+                    pb->mBuffer = newbufs.back().get();
+                    pb->mBuffer->setPendingLoad(pending[newbufs.size()-1]);
+                }
+                batch->mBuffers[missing[i].second] = newbufs.back().get();
+            }
+        }
+        catch(...) {
+            alDeleteBuffers(bids.size(), bids.data());
+            throw;
+        }
+
+        // Space was reserved above, so this won't need to grow the cache.
+        for(size_t i = 0;i < newbufs.size();++i)
+        {
+            const PendingBuffer *pb = pending[i].get();
+            uint64_t size = FramesToBytes(pb->mFrames, newbufs[i]->getChannelConfig(),
+                                          newbufs[i]->getSampleType());
+            mBuffers.insert(std::move(newbufs[i]), size);
+        }
+    }
+
+    // Attach the batch to each buffer that has yet to load, which includes
+    // ones still pending from earlier requests.
+    SharedFuture<Vector<Buffer*>> future = batch->mPromise.get_future().share();
+    {
+        std::lock_guard<std::mutex> lock(mBatchMutex);
+        for(Buffer *buffer : batch->mBuffers)
+        {
+            ALBuffer *albuf = static_cast<ALBuffer*>(buffer);
+            if(!albuf->isLoaded())
+            {
+                albuf->addBatch(batch);
+                ++batch->mRemaining;
+            }
+        }
+        if(batch->mRemaining == 0)
+            batch->mPromise.set_value(batch->mBuffers);
+    }
+
+    if(!pending.empty())
+    {
+        startAsyncThreads();
+
+        mStats.mPendingLoads.fetch_add(pending.size(), std::memory_order_relaxed);
+        for(auto &pb : pending)
+            queueLoad(std::move(pb), priority);
+        wakeDecodeThreads(pending.size());
+    }
+
+    return future;
+}
+
+
+void ALContext::removeBuffer(const String &name)
+{
+    CheckContext(this);
+    if(ALBuffer *buffer = mBuffers.find(name))
+    {
+        buffer->cleanup();
+        mBuffers.erase(name);
     }
 }
 
@@ -642,30 +1277,82 @@ void ALContext::removeBuffer(Buffer *buffer)
 }
 
 
-ALuint ALContext::getSourceId(ALuint maxprio)
+ALuint ALContext::genSourceIds(ALuint count)
+{
+    size_t oldsize = mFreshSourceIds.size();
+    mFreshSourceIds.resize(oldsize+count);
+    alGetError();
+    alGenSources(count, &mFreshSourceIds[oldsize]);
+    if(alGetError() != AL_NO_ERROR)
+    {
+        // Nothing is generated if the device can't provide them all, so take
+        // as many as it has one at a time.
+        mFreshSourceIds.resize(oldsize);
+        ALuint id;
+        while(count-- > 0)
+        {
+            alGenSources(1, &id);
+            if(alGetError() != AL_NO_ERROR)
+                break;
+            mFreshSourceIds.push_back(id);
+        }
+    }
+    return mFreshSourceIds.size() - oldsize;
+}
+
+ALuint ALContext::reserveSources(ALuint count)
 {
     CheckContext(this);
 
-    ALuint id = 0;
-    if(mSourceIds.empty())
+    size_t idle = mSourceIds.size() + mFreshSourceIds.size();
+    if(idle < count)
+        genSourceIds(count - idle);
+    return mSourceIds.size() + mFreshSourceIds.size();
+}
+
+bool ALContext::tryGetSourceId(ALuint &id, bool &fresh)
+{
+    // Unused IDs need the fewest properties set, so they go first.
+    if(!mFreshSourceIds.empty())
     {
-        alGetError();
-        alGenSources(1, &id);
-        if(alGetError() == AL_NO_ERROR)
-            return id;
+        id = mFreshSourceIds.back();
+        mFreshSourceIds.pop_back();
+        fresh = true;
+        return true;
+    }
+    fresh = false;
+    if(!mSourceIds.empty())
+    {
+        id = mSourceIds.top();
+        mSourceIds.pop();
+        return true;
+    }
 
-        ALSource *lowest = nullptr;
-        for(ALSource *src : mUsedSources)
-        {
-            if(src->getId() != 0 && (!lowest || src->getPriority() < lowest->getPriority()))
-                lowest = src;
-        }
-        if(lowest && lowest->getPriority() < maxprio)
-        {
-            lowest->makeStopped();
-            if(mMessage.get())
-                mMessage->sourceStopped(lowest, true);
-        }
+    alGetError();
+    alGenSources(1, &id);
+    addALCalls(3);
+    if(alGetError() != AL_NO_ERROR)
+        return false;
+    fresh = true;
+    return true;
+}
+
+ALuint ALContext::getSourceId(ALuint maxprio, bool &fresh)
+{
+    CheckContext(this);
+
+    ALuint id = 0;
+    if(tryGetSourceId(id, fresh))
+        return id;
+
+    if(mVoiceScoresStale)
+        scoreVoices();
+    ALSource *lowest = mVoiceHeap.empty() ? nullptr : mVoiceHeap.front();
+    if(lowest && lowest->getPriority() < maxprio)
+    {
+        lowest->makeStopped();
+        if(mMessage.get())
+            mMessage->sourceStopped(lowest, true);
     }
     if(mSourceIds.empty())
         throw std::runtime_error("No available sources");
@@ -713,6 +1400,28 @@ void ALContext::addStream(ALSource *source)
     auto iter = std::lower_bound(mStreamingSources.begin(), mStreamingSources.end(), source);
     if(iter == mStreamingSources.end() || *iter != source)
         mStreamingSources.insert(iter, source);
+    scheduleStreamNoLock(source);
+}
+
+void ALContext::scheduleStreamNoLock(ALSource *source)
+{
+    if(isRenderDriven())
+        return;
+    StreamDeadline entry{std::chrono::steady_clock::now(), source};
+    source->setStreamDeadline(entry.mTime);
+    mStreamQueue.push(entry);
+
+    mWakeMutex.lock(); mWakeMutex.unlock();
+    mWakeThread.notify_all();
+}
+
+void ALContext::rescheduleStream(ALSource *source)
+{
+    std::lock_guard<std::mutex> lock(mSourceStreamMutex);
+    // Starved streams are already checked whenever the thread wakes.
+    if(isStreamingNoLock(source) &&
+       source->getStreamDeadline() != std::chrono::steady_clock::time_point::min())
+        scheduleStreamNoLock(source);
 }
 
 void ALContext::removeStream(ALSource *source)
@@ -731,6 +1440,31 @@ void ALContext::removeStreamNoLock(ALSource *source)
 }
 
 
+void ALContext::setSourceTransforms(Source *const *sources, size_t count, const ALfloat *positions,
+                                    const ALfloat *velocities, const ALfloat *directions)
+{
+    CheckContext(this);
+    for(size_t i = 0;i < count;++i)
+    {
+        ALSource *alsrc = cast<ALSource*>(sources[i]);
+        if(!alsrc) throw std::runtime_error("Source is not valid");
+        if(alsrc->getContext() != this)
+            throw std::runtime_error("Source is from a different context");
+    }
+
+    // Only the stored state changes here. Sources that are playing get their
+    // new transforms in the next batched commit.
+    for(size_t i = 0;i < count;++i)
+    {
+        static_cast<ALSource*>(sources[i])->setTransform(
+            positions ? positions + i*3 : nullptr,
+            velocities ? velocities + i*3 : nullptr,
+            directions ? directions + i*3 : nullptr
+        );
+    }
+}
+
+
 AuxiliaryEffectSlot *ALContext::createAuxiliaryEffectSlot()
 {
     if(!hasExtension(EXT_EFX) || !alGenAuxiliaryEffectSlots)
@@ -829,20 +1563,245 @@ void ALContext::setDistanceModel(DistanceModel model)
 {
     CheckContext(this);
     alDistanceModel((ALenum)model);
+    mDistanceModel = model;
 }
 
 
-void ALContext::update()
+void ALContext::setMaxVoices(ALuint count)
 {
     CheckContext(this);
-    std::for_each(mUsedSources.begin(), mUsedSources.end(), std::mem_fn(&ALSource::updateNoCtxCheck));
-    if(!mWakeInterval.load())
+    mMaxVoices = count;
+}
+
+void ALContext::setVoiceCullGain(ALfloat gain)
+{
+    if(!(gain >= 0.0f && gain <= 1.0f))
+        throw std::runtime_error("Cull gain out of range");
+    CheckContext(this);
+    mVoiceCullGain = gain;
+}
+
+// Whether source a should lose its voice before source b.
+static inline bool VoiceBefore(const ALSource *a, const ALSource *b)
+{
+    return a->getPriority() < b->getPriority() ||
+           (a->getPriority() == b->getPriority() && a->getVoiceScore() < b->getVoiceScore());
+}
+
+void ALContext::siftVoiceUp(size_t idx)
+{
+    ALSource *source = mVoiceHeap[idx];
+    while(idx > 0)
     {
-        // For performance reasons, don't wait for the thread's mutex. This
-        // should be called often enough to keep up with any and all streams
-        // regardless.
-        mWakeThread.notify_all();
+        size_t parent = (idx-1) / 2;
+        if(!VoiceBefore(source, mVoiceHeap[parent]))
+            break;
+        mVoiceHeap[idx] = mVoiceHeap[parent];
+        mVoiceHeap[idx]->setVoiceIndex(idx);
+        idx = parent;
+    }
+    mVoiceHeap[idx] = source;
+    source->setVoiceIndex(idx);
+}
+
+void ALContext::siftVoiceDown(size_t idx)
+{
+    ALSource *source = mVoiceHeap[idx];
+    size_t count = mVoiceHeap.size();
+    while(idx*2 + 1 < count)
+    {
+        size_t child = idx*2 + 1;
+        if(child+1 < count && VoiceBefore(mVoiceHeap[child+1], mVoiceHeap[child]))
+            ++child;
+        if(!VoiceBefore(mVoiceHeap[child], source))
+            break;
+        mVoiceHeap[idx] = mVoiceHeap[child];
+        mVoiceHeap[idx]->setVoiceIndex(idx);
+        idx = child;
+    }
+    mVoiceHeap[idx] = source;
+    source->setVoiceIndex(idx);
+}
+
+void ALContext::addVoice(ALSource *source)
+{
+    scoreSource(source);
+    if(source->getVoiceIndex() != std::numeric_limits<size_t>::max())
+        updateVoice(source);
+    else
+    {
+        mVoiceHeap.push_back(source);
+        siftVoiceUp(mVoiceHeap.size()-1);
+    }
+}
+
+void ALContext::removeVoice(ALSource *source)
+{
+    size_t idx = source->getVoiceIndex();
+    if(idx == std::numeric_limits<size_t>::max())
+        return;
+    source->setVoiceIndex(std::numeric_limits<size_t>::max());
+
+    ALSource *last = mVoiceHeap.back();
+    mVoiceHeap.pop_back();
+    if(idx < mVoiceHeap.size())
+    {
+        mVoiceHeap[idx] = last;
+        last->setVoiceIndex(idx);
+        updateVoice(last);
+    }
+}
+
+void ALContext::updateVoice(ALSource *source)
+{
+    size_t idx = source->getVoiceIndex();
+    if(idx > 0 && VoiceBefore(source, mVoiceHeap[(idx-1) / 2]))
+        siftVoiceUp(idx);
+    else
+        siftVoiceDown(idx);
+}
+
+void ALContext::scoreSource(ALSource *source)
+{
+    ALfloat gain = source->getAudibleGain(mListenerPosition, mDistanceModel);
+    ALfloat remaining = source->getRemainingTime();
+    source->setVoiceScore(gain, mVoiceScorer ? mVoiceScorer->getScore(source, gain, remaining) :
+                                               DefaultVoiceScore(gain, remaining));
+}
+
+void ALContext::scoreVoices()
+{
+    for(ALSource *source : mUsedSources)
+    {
+        if(source->getId() != 0 || source->isVirtual())
+            scoreSource(source);
+    }
+    // Rebuild the heap for the new scores.
+    for(size_t i = mVoiceHeap.size()/2;i > 0;)
+        siftVoiceDown(--i);
+    mVoiceScoresStale = false;
+}
+
+
+SharedPtr<VoiceScorer> ALContext::setVoiceScorer(SharedPtr<VoiceScorer> scorer)
+{
+    CheckContext(this);
+    mVoiceScorer.swap(scorer);
+    return scorer;
+}
+
+void ALContext::updateVoices()
+{
+    ALuint id;
+    bool fresh;
+
+    if(mMaxVoices == 0 && !(mVoiceCullGain > 0.0f))
+    {
+        // Without any limits, sources left virtual just need a voice back.
+        for(ALSource *source : mUsedSources)
+        {
+            if(!source->isVirtual() || !source->canVirtualize())
+                continue;
+            if(!tryGetSourceId(id, fresh))
+                break;
+            source->makeReal(id, fresh);
+        }
+        return;
+    }
+
+    Batcher batcher = getBatcher();
+
+    // The voices are all in mVoiceHeap, worst on top. Those that can't be made
+    // virtual are taken out until a worst one that can is found, and put back
+    // at the end.
+    auto worst_voice = [this]() -> ALSource*
+    {
+        while(!mVoiceHeap.empty() && !mVoiceHeap.front()->canVirtualize())
+        {
+            mFixedVoices.push_back(mVoiceHeap.front());
+            removeVoice(mFixedVoices.back());
+        }
+        return mVoiceHeap.empty() ? nullptr : mVoiceHeap.front();
+    };
+    auto voice_count = [this]() -> size_t
+    { return mVoiceHeap.size() + mFixedVoices.size(); };
+
+    // Sources too quiet to hear give up their voice, then the worst go until
+    // the rest fit.
+    if(mVoiceCullGain > 0.0f)
+    {
+        for(ALSource *source : mUsedSources)
+        {
+            if(source->getId() != 0 && source->canVirtualize() &&
+               source->getVoiceGain() < mVoiceCullGain)
+                source->makeVirtual();
+        }
+    }
+    if(mMaxVoices > 0)
+    {
+        ALSource *worst;
+        while(voice_count() > mMaxVoices && (worst=worst_voice()) != nullptr)
+            worst->makeVirtual();
+    }
+
+    // Virtual sources loud enough to keep take a free voice, or the worst one
+    // if they rank better.
+    for(ALSource *source : mUsedSources)
+    {
+        if(!source->isVirtual() || !source->canVirtualize() ||
+           source->getVoiceGain() < mVoiceCullGain)
+            continue;
+        if((mMaxVoices == 0 || voice_count() < mMaxVoices) && tryGetSourceId(id, fresh))
+        {
+            source->makeReal(id, fresh);
+            continue;
+        }
+
+        ALSource *worst = worst_voice();
+        if(!worst || !VoiceBefore(worst, source))
+            continue;
+        worst->makeVirtual();
+        if(tryGetSourceId(id, fresh))
+            source->makeReal(id, fresh);
+    }
+
+    for(ALSource *source : mFixedVoices)
+    {
+        mVoiceHeap.push_back(source);
+        siftVoiceUp(mVoiceHeap.size()-1);
+    }
+    mFixedVoices.clear();
+}
+
+
+void ALContext::commitSources()
+{
+    if(mDirtySources.empty())
+        return;
+
+    // Apply all the changes in one go, instead of having OpenAL process each
+    // one as it's made.
+    {
+        Batcher batcher = getBatcher();
+        for(ALSource *source : mDirtySources)
+            source->commitProperties();
     }
+    mDirtySources.clear();
+}
+
+void ALContext::update()
+{
+    CheckContext(this);
+    ALuint startcalls = mALCalls;
+    std::for_each(mUsedSources.begin(), mUsedSources.end(), std::mem_fn(&ALSource::updateNoCtxCheck));
+    // Scores only matter here when there are voice limits. Otherwise they're
+    // only needed if a voice has to be stolen.
+    if(mMaxVoices > 0 || mVoiceCullGain > 0.0f)
+        scoreVoices();
+    else
+        mVoiceScoresStale = true;
+    updateVoices();
+    commitSources();
 
     if(hasExtension(EXT_disconnect) && mIsConnected)
     {
@@ -850,7 +1809,52 @@ void ALContext::update()
         alcGetIntegerv(alcGetContextsDevice(mContext), ALC_CONNECTED, 1, &connected);
         if(!connected && mMessage.get()) mMessage->deviceDisconnected(mDevice);
         mIsConnected = connected;
+        addALCalls(1);
+    }
+    mUpdateALCalls = mALCalls - startcalls;
+}
+
+void ALContext::renderUpdate()
+{
+    Vector<ALSource*> streams;
+    {
+        std::lock_guard<std::mutex> lock(mSourceStreamMutex);
+        streams = mStreamingSources;
+    }
+    for(ALSource *source : streams)
+    {
+        std::chrono::nanoseconds delay;
+        if(!source->updateAsync(delay))
+            removeStream(source);
+    }
+    update();
+}
+
+ContextStats ALContext::getStats()
+{
+    CheckContext(this);
+
+    ContextStats stats;
+    {
+        std::lock_guard<std::mutex> lock(mDecoderStatsMutex);
+        stats.mDecoders.reserve(mDecoderStats.size());
+        for(const auto &entry : mDecoderStats)
+            stats.mDecoders.push_back(DecoderStats{entry.first,
+                entry.second->mDecodeTime.load(std::memory_order_relaxed),
+                entry.second->mFrames.load(std::memory_order_relaxed)
+            });
     }
+    stats.mUnderruns = mStats.mUnderruns.load(std::memory_order_relaxed);
+    stats.mPendingBuffers = mStats.mPendingLoads.load(std::memory_order_relaxed);
+    stats.mBackgroundTime = mStats.mBackgroundTime.load(std::memory_order_relaxed);
+    stats.mCacheHits = mStats.mCacheHits.load(std::memory_order_relaxed);
+    stats.mCacheMisses = mStats.mCacheMisses.load(std::memory_order_relaxed);
+    stats.mCacheBytes = mBuffers.getTotalSize();
+    stats.mActiveSources = mVoiceHeap.size();
+    stats.mVirtualSources = mVirtualSources;
+    stats.mFreeSources = mSourceIds.size() + mFreshSourceIds.size();
+    stats.mUpdateALCalls = mUpdateALCalls;
+    return stats;
 }
 
 
@@ -867,12 +1871,18 @@ void ALContext::setPosition(ALfloat x, ALfloat y, ALfloat z)
 {
     CheckContext(this);
     alListener3f(AL_POSITION, x, y, z);
+    mListenerPosition[0] = x;
+    mListenerPosition[1] = y;
+    mListenerPosition[2] = z;
 }
 
 void ALContext::setPosition(const ALfloat *pos)
 {
     CheckContext(this);
     alListenerfv(AL_POSITION, pos);
+    mListenerPosition[0] = pos[0];
+    mListenerPosition[1] = pos[1];
+    mListenerPosition[2] = pos[2];
 }
 
 void ALContext::setVelocity(ALfloat x, ALfloat y, ALfloat z)
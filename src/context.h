@@ -4,21 +4,26 @@
 #include "main.h"
 
 #include <condition_variable>
+#include <functional>
+#include <chrono>
 #include <unordered_map>
 #include <stdexcept>
 #include <thread>
 #include <mutex>
 #include <stack>
 #include <queue>
+#include <deque>
 #include <set>
+#include <map>
 
 #include "alc.h"
 #include "alext.h"
 
 #include "refcount.h"
-#include "ringbuf.h"
 #include "device.h"
 #include "source.h"
+#include "buffercache.h"
+#include "mpscqueue.h"
 
 #define F_PI (3.14159265358979323846f)
 
@@ -27,6 +32,7 @@ namespace alure {
 class ALDevice;
 class ALBuffer;
 class ALSourceGroup;
+class StreamDecoder;
 
 enum ALExtension {
     EXT_EFX,
@@ -70,6 +76,32 @@ public:
 };
 
 
+// Running totals for one type of decoder, shared by every decoder of that type.
+struct DecoderCounters {
+    std::atomic<uint64_t> mDecodeTime;
+    std::atomic<uint64_t> mFrames;
+
+    DecoderCounters() : mDecodeTime(0), mFrames(0) { }
+};
+
+// Counters updated from any thread. They're only ever read together for a
+// stats snapshot, so relaxed ordering is enough.
+struct StatCounters {
+    std::atomic<uint64_t> mUnderruns;
+    std::atomic<uint64_t> mBackgroundTime;
+    std::atomic<uint64_t> mCacheHits;
+    std::atomic<uint64_t> mCacheMisses;
+    std::atomic<ALuint> mPendingLoads;
+
+    StatCounters()
+      : mUnderruns(0), mBackgroundTime(0), mCacheHits(0), mCacheMisses(0), mPendingLoads(0)
+    { }
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t count)
+    { counter.fetch_add(count, std::memory_order_relaxed); }
+};
+
+
 class ALContext : public Context, public Listener {
     static ALContext *sCurrentCtx;
     static thread_local ALContext *sThreadCurrentCtx;
@@ -83,14 +115,48 @@ public:
 
 private:
     ALCcontext *mContext;
+    // IDs released by sources that stopped, and IDs generated ahead of time
+    // that were never used (so still have the default properties).
     std::stack<ALuint> mSourceIds;
+    Vector<ALuint> mFreshSourceIds;
+    // How many IDs to generate once the context is first made current.
+    ALuint mInitialSources;
+    ALuint genSourceIds(ALuint count);
 
     ALDevice *const mDevice;
     std::deque<ALSource> mAllSources;
     std::queue<ALSource*> mFreeSources;
     Vector<ALSource*> mUsedSources;
 
-    Vector<UniquePtr<ALBuffer>> mBuffers;
+    // The voice limit and cull gain, each disabled when 0.
+    ALuint mMaxVoices;
+    ALfloat mVoiceCullGain;
+    // Voices that can't be made virtual, set aside while updateVoices looks
+    // for the worst one that can.
+    Vector<ALSource*> mFixedVoices;
+    void updateVoices();
+
+    // Sources with an OpenAL source, as a min-heap on priority then score, so
+    // the first to be stopped when OpenAL runs out is on top. Sources keep
+    // their own index, so they can be moved or removed in O(log n).
+    Vector<ALSource*> mVoiceHeap;
+    void siftVoiceUp(size_t idx);
+    void siftVoiceDown(size_t idx);
+
+    SharedPtr<VoiceScorer> mVoiceScorer;
+    void scoreSource(ALSource *source);
+    void scoreVoices();
+    // Set when update skips scoring because there are no voice limits, so
+    // getSourceId knows to score before stealing a voice.
+    bool mVoiceScoresStale;
+
+    // Kept for estimating source gains without querying OpenAL.
+    Vector3 mListenerPosition;
+    DistanceModel mDistanceModel;
+
+    BufferCache mBuffers;
+    std::atomic<uint64_t> mBufferBudget;
+    void evictBuffers(uint64_t needed, uint64_t protect);
 
     Vector<UniquePtr<ALSourceGroup>> mSourceGroups;
 
@@ -100,21 +166,76 @@ private:
 
     bool mHasExt[AL_EXTENSION_MAX];
 
-    struct PendingBuffer {
-        String mName;
-        ALBuffer *mBuffer;
-        SharedPtr<Decoder> mDecoder;
-        ALenum mFormat;
-        ALuint mFrames;
-
-        ~PendingBuffer() { }
+    // Queue entries for pending loads. A load may be queued more than once if
+    // its priority was raised, and only the first thread to claim it decodes
+    // it.
+    struct PendingLoad : QueueNode {
+        SharedPtr<PendingBuffer> mJob;
     };
-    RingBuffer mPendingBuffers;
+    // Loads waiting for a decode thread, with one queue per LoadPriority. Any
+    // thread can add to them without locking, while the decode threads take
+    // from them holding mPendingMutex, spinning briefly if they catch a load
+    // halfway through being added.
+    MpscQueue<PendingLoad> mPendingBuffers[3];
+    void queueLoad(SharedPtr<PendingBuffer> job, LoadPriority priority);
+    UniquePtr<PendingLoad> popPendingLoad();
+    bool hasPendingLoads() const;
+    void raiseLoadPriority(ALBuffer *buffer, LoadPriority priority);
+    // Streams waiting for a decode thread. Protected by mPendingMutex.
+    std::deque<SharedPtr<StreamDecoder>> mPendingStreams;
+    std::mutex mPendingMutex;
+    std::condition_variable mPendingCond;
+    // Number of decode threads waiting on mPendingCond. Submitting buffers
+    // only locks mPendingMutex, to notify, when there are any.
+    std::atomic<ALuint> mPendingWaiters;
+    void wakeDecodeThreads(size_t count);
+    // Decoded buffers waiting to be uploaded by the background thread.
+    // Protected by mWakeMutex.
+    Vector<SharedPtr<PendingBuffer>> mDecodedBuffers;
+
+    std::atomic<ALuint> mDecodeThreadCount;
+    Vector<std::thread> mDecodeThreads;
+    void decodeProc();
+
+    // Protects the batch lists on buffers being loaded with getBuffersAsync.
+    std::mutex mBatchMutex;
+    void finishBatches(ALBuffer *buffer);
+    // Uploads a decoded buffer and wakes anything waiting on it.
+    void finishLoad(PendingBuffer *pb);
+
+    // Signalled after a buffer is uploaded, for threads waiting on a load.
+    std::mutex mLoadMutex;
+    std::condition_variable mLoadCond;
+
+    // Sources with property changes waiting to be applied. A source may be
+    // listed more than once, but only commits its changes the first time.
+    Vector<ALSource*> mDirtySources;
 
     Vector<ALSource*> mStreamingSources;
     std::mutex mSourceStreamMutex;
 
+    // Streaming sources ordered by when they next need refilling, earliest
+    // first. An entry is stale if its source's deadline has since changed.
+    struct StreamDeadline {
+        std::chrono::steady_clock::time_point mTime;
+        ALSource *mSource;
+
+        bool operator>(const StreamDeadline &rhs) const { return mTime > rhs.mTime; }
+    };
+    std::priority_queue<StreamDeadline,Vector<StreamDeadline>,std::greater<StreamDeadline>> mStreamQueue;
+    // Streams waiting on the decode threads, checked whenever the background
+    // thread wakes. Both are protected by the source stream mutex.
+    Vector<ALSource*> mStarvedStreams;
+    bool isStreamingNoLock(ALSource *source) const;
+    void updateStream(ALSource *source, std::chrono::steady_clock::time_point now,
+                      std::chrono::nanoseconds mindelay);
+
     std::atomic<ALuint> mWakeInterval;
+
+    std::atomic<SampleType> mPreferredType;
+
+    mutable std::mutex mDecodeCacheMutex;
+    String mDecodeCacheDir;
     std::mutex mWakeMutex;
     std::condition_variable mWakeThread;
 
@@ -130,8 +251,19 @@ private:
     bool mIsConnected;
     bool mIsBatching;
 
+    StatCounters mStats;
+    // Per-type decoder counters, keyed by factory name.
+    std::map<String,SharedPtr<DecoderCounters>> mDecoderStats;
+    std::mutex mDecoderStatsMutex;
+    SharedPtr<DecoderCounters> getDecoderCounters(const String &name);
+    // OpenAL calls made from the app thread, and how many the last update made.
+    ALuint mALCalls;
+    ALuint mUpdateALCalls;
+    // Sources currently virtual, kept so getStats needn't count them.
+    ALuint mVirtualSources;
+
 public:
-    ALContext(ALCcontext *context, ALDevice *device);
+    ALContext(ALCcontext *context, ALDevice *device, ALuint initsources);
     virtual ~ALContext();
 
     ALCcontext *getContext() const { return mContext; }
@@ -178,12 +310,55 @@ public:
     LPALGETAUXILIARYEFFECTSLOTF alGetAuxiliaryEffectSlotf;
     LPALGETAUXILIARYEFFECTSLOTFV alGetAuxiliaryEffectSlotfv;
 
-    ALuint getSourceId(ALuint maxprio);
+    // `fresh' is set if the ID was newly generated, so still has the default
+    // properties.
+    ALuint getSourceId(ALuint maxprio, bool &fresh);
+    // As above, but fails instead of stopping another source.
+    bool tryGetSourceId(ALuint &id, bool &fresh);
+
+    // Scores a source that got an OpenAL source and adds it to the voice heap,
+    // or repositions it if it's already there.
+    void addVoice(ALSource *source);
+    void removeVoice(ALSource *source);
+    // Repositions a source in the voice heap after its priority changed.
+    void updateVoice(ALSource *source);
     void insertSourceId(ALuint id) { mSourceIds.push(id); }
 
+    // Only called from the app thread.
+    void addALCalls(ALuint count) { mALCalls += count; }
+    void countVirtualSource(bool isvirtual)
+    { if(isvirtual) ++mVirtualSources; else --mVirtualSources; }
+    void countUnderrun() { StatCounters::add(mStats.mUnderruns, 1); }
+
+    void startAsyncThreads();
+    void addStreamDecode(SharedPtr<StreamDecoder> stream);
+
+    // Loopback devices render on request, so the background thread leaves
+    // their streams alone and they're refilled here, synchronously, before
+    // each device update is rendered.
+    bool isRenderDriven() const { return mDevice->isLoopback(); }
+    void renderUpdate();
+    std::chrono::steady_clock::time_point getClockTime() const { return mDevice->getClockTime(); }
+
     void addStream(ALSource *source);
     void removeStream(ALSource *source);
     void removeStreamNoLock(ALSource *source);
+    // Pulls a playing stream's next refill forward to now, as after its pitch
+    // goes up.
+    void rescheduleStream(ALSource *source);
+    // Has the background thread service the stream right away.
+    void scheduleStreamNoLock(ALSource *source);
+
+    void touchBuffer(ALBuffer *buffer) { mBuffers.touch(buffer); }
+
+    void addDirtySource(ALSource *source) { mDirtySources.push_back(source); }
+    void commitSources();
+
+    /* Waits for an asynchronously loaded buffer to finish loading, raising its
+     * priority first. The timed version returns false if it timed out.
+     */
+    void waitForLoad(ALBuffer *buffer);
+    bool waitForLoad(ALBuffer *buffer, std::chrono::milliseconds timeout);
 
     void freeSource(ALSource *source);
     void freeSourceGroup(ALSourceGroup *group);
@@ -193,6 +368,8 @@ public:
         if(mIsBatching)
             return Batcher(nullptr);
         alcSuspendContext(mContext);
+        // Along with the alcProcessContext when the batcher goes away.
+        addALCalls(2);
         return Batcher(mContext);
     }
 
@@ -219,17 +396,39 @@ public:
     void setAsyncWakeInterval(ALuint msec) override final;
     ALuint getAsyncWakeInterval() const override final;
 
+    void setAsyncDecodeThreads(ALuint count) override final;
+    ALuint getAsyncDecodeThreads() const override final;
+
+    void setBufferCacheBudget(uint64_t bytes) override final;
+    uint64_t getBufferCacheBudget() const override final;
+
+    void setPreferredSampleType(SampleType type) override final;
+    SampleType getPreferredSampleType() const override final;
+
+    void setDecodeCacheDirectory(const String &path) override final;
+    String getDecodeCacheDirectory() const override final;
+
     SharedPtr<Decoder> createDecoder(const String &name) override final;
 
     bool isSupported(ChannelConfig channels, SampleType type) const override final;
 
     Buffer *getBuffer(const String &name) override final;
-    Buffer *getBufferAsync(const String &name) override final;
+    Buffer *getBufferAsync(const String &name) override final
+    { return getBufferAsync(name, LoadPriority::Normal); }
+    Buffer *getBufferAsync(const String &name, LoadPriority priority) override final;
+    SharedFuture<Vector<Buffer*>> getBuffersAsync(const Vector<String> &names) override final
+    { return getBuffersAsync(names, LoadPriority::Normal); }
+    SharedFuture<Vector<Buffer*>> getBuffersAsync(const Vector<String> &names, LoadPriority priority) override final;
     void removeBuffer(const String &name) override final;
     void removeBuffer(Buffer *buffer) override final;
 
     Source *createSource() override final;
 
+    ALuint reserveSources(ALuint count) override final;
+
+    void setSourceTransforms(Source *const *sources, size_t count, const ALfloat *positions,
+                             const ALfloat *velocities, const ALfloat *directions) override final;
+
     AuxiliaryEffectSlot *createAuxiliaryEffectSlot() override final;
 
     Effect *createEffect() override final;
@@ -243,6 +442,18 @@ public:
 
     void setDistanceModel(DistanceModel model) override final;
 
+    void setMaxVoices(ALuint count) override final;
+    ALuint getMaxVoices() const override final { return mMaxVoices; }
+
+    void setVoiceCullGain(ALfloat gain) override final;
+    ALfloat getVoiceCullGain() const override final { return mVoiceCullGain; }
+
+    SharedPtr<VoiceScorer> setVoiceScorer(SharedPtr<VoiceScorer> scorer) override final;
+    SharedPtr<VoiceScorer> getVoiceScorer() const override final
+    { return mVoiceScorer; }
+
+    ContextStats getStats() override final;
+
     void update() override final;
 
     // Listener methods
@@ -7,10 +7,201 @@
 
 #include "FLAC/all.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 
 namespace alure
 {
 
+/* Output sample types, and how FLAC samples of each bit depth convert to them.
+ * 8-bit samples become unsigned bytes, while 16- and 24-bit samples become
+ * 16-bit.
+ */
+template<int Bits> struct FlacSample;
+template<> struct FlacSample<8> {
+    using Type = ALubyte;
+    static ALubyte convert(FLAC__int32 sample) { return ALubyte(sample + 0x80); }
+};
+template<> struct FlacSample<16> {
+    using Type = ALshort;
+    static ALshort convert(FLAC__int32 sample) { return ALshort(sample); }
+};
+template<> struct FlacSample<24> {
+    using Type = ALshort;
+    static ALshort convert(FLAC__int32 sample) { return ALshort(sample >> 8); }
+};
+
+
+/* Vectorized interleaving for the common mono and stereo 16- and 24-bit
+ * cases. Each returns the number of frames it handled from the start, leaving
+ * the rest to the scalar loop.
+ */
+template<ALuint Channels, int Bits>
+struct FlacSimd {
+    static ALuint interleave(typename FlacSample<Bits>::Type*, const FLAC__int32 *const[], ALuint)
+    { return 0; }
+};
+
+#if defined(__SSE2__)
+
+template<int Shift>
+static inline __m128i LoadFlac8(const FLAC__int32 *src)
+{
+    __m128i lo = _mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), Shift);
+    __m128i hi = _mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src+4)), Shift);
+    return _mm_packs_epi32(lo, hi);
+}
+
+template<int Bits>
+struct FlacSimd<1,Bits> {
+    static ALuint interleave(ALshort *samples, const FLAC__int32 *const buffer[], ALuint todo)
+    {
+        ALuint i = 0;
+        for(;todo-i >= 8;i += 8)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(samples+i), LoadFlac8<Bits-16>(buffer[0]+i));
+        return i;
+    }
+};
+
+template<int Bits>
+struct FlacSimd<2,Bits> {
+    static ALuint interleave(ALshort *samples, const FLAC__int32 *const buffer[], ALuint todo)
+    {
+        ALuint i = 0;
+        for(;todo-i >= 8;i += 8)
+        {
+            __m128i left = LoadFlac8<Bits-16>(buffer[0]+i);
+            __m128i right = LoadFlac8<Bits-16>(buffer[1]+i);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(samples + i*2), _mm_unpacklo_epi16(left, right));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(samples + i*2 + 8), _mm_unpackhi_epi16(left, right));
+        }
+        return i;
+    }
+};
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+template<int Shift>
+static inline int16x8_t LoadFlac8(const FLAC__int32 *src)
+{
+    const int32x4_t shift = vdupq_n_s32(-Shift);
+    return vcombine_s16(vmovn_s32(vshlq_s32(vld1q_s32(src), shift)),
+                        vmovn_s32(vshlq_s32(vld1q_s32(src+4), shift)));
+}
+
+template<int Bits>
+struct FlacSimd<1,Bits> {
+    static ALuint interleave(ALshort *samples, const FLAC__int32 *const buffer[], ALuint todo)
+    {
+        ALuint i = 0;
+        for(;todo-i >= 8;i += 8)
+            vst1q_s16(samples+i, LoadFlac8<Bits-16>(buffer[0]+i));
+        return i;
+    }
+};
+
+template<int Bits>
+struct FlacSimd<2,Bits> {
+    static ALuint interleave(ALshort *samples, const FLAC__int32 *const buffer[], ALuint todo)
+    {
+        ALuint i = 0;
+        for(;todo-i >= 8;i += 8)
+        {
+            int16x8x2_t frames = {{ LoadFlac8<Bits-16>(buffer[0]+i), LoadFlac8<Bits-16>(buffer[1]+i) }};
+            vst2q_s16(samples + i*2, frames);
+        }
+        return i;
+    }
+};
+
+#endif
+
+#if defined(__SSE2__) || (defined(__aarch64__) && defined(__ARM_NEON))
+// 8-bit samples are left to the scalar loop.
+template<>
+struct FlacSimd<1,8> {
+    static ALuint interleave(ALubyte*, const FLAC__int32 *const[], ALuint) { return 0; }
+};
+template<>
+struct FlacSimd<2,8> {
+    static ALuint interleave(ALubyte*, const FLAC__int32 *const[], ALuint) { return 0; }
+};
+#endif
+
+
+// Interleaves `todo' frames from the planar FLAC buffers, starting at the
+// given frame offset.
+using FlacInterleaver = void(*)(ALubyte *output, const FLAC__int32 *const buffer[], ALuint offset,
+                                ALuint todo, ALuint channels, ALuint bits);
+
+template<ALuint Channels, int Bits>
+static void InterleaveFlac(ALubyte *output, const FLAC__int32 *const buffer[], ALuint offset,
+                           ALuint todo, ALuint, ALuint)
+{
+    using SampleT = typename FlacSample<Bits>::Type;
+    SampleT *samples = reinterpret_cast<SampleT*>(output);
+
+    const FLAC__int32 *src[Channels];
+    for(ALuint c = 0;c < Channels;++c)
+        src[c] = buffer[c] + offset;
+
+    ALuint i = FlacSimd<Channels,Bits>::interleave(samples, src, todo);
+    for(;i < todo;++i)
+    {
+        for(ALuint c = 0;c < Channels;++c)
+            samples[i*Channels + c] = FlacSample<Bits>::convert(src[c][i]);
+    }
+}
+
+// For less common bit depths, which are scaled to 16-bit.
+static void InterleaveFlacAny(ALubyte *output, const FLAC__int32 *const buffer[], ALuint offset,
+                              ALuint todo, ALuint channels, ALuint bits)
+{
+    ALshort *samples = reinterpret_cast<ALshort*>(output);
+    for(ALuint c = 0;c < channels;++c)
+    {
+        const FLAC__int32 *src = buffer[c] + offset;
+        if(bits > 16)
+        {
+            for(ALuint i = 0;i < todo;++i)
+                samples[i*channels + c] = ALshort(src[i] >> (bits-16));
+        }
+        else
+        {
+            for(ALuint i = 0;i < todo;++i)
+                samples[i*channels + c] = ALshort(src[i] * (1 << (16-bits)));
+        }
+    }
+}
+
+template<int Bits>
+static FlacInterleaver GetFlacInterleaver(ALuint channels)
+{
+    switch(channels)
+    {
+        case 1: return InterleaveFlac<1,Bits>;
+        case 2: return InterleaveFlac<2,Bits>;
+        case 4: return InterleaveFlac<4,Bits>;
+        case 6: return InterleaveFlac<6,Bits>;
+        case 7: return InterleaveFlac<7,Bits>;
+        case 8: return InterleaveFlac<8,Bits>;
+    }
+    return InterleaveFlacAny;
+}
+
+static FlacInterleaver GetFlacInterleaver(ALuint channels, ALuint bits)
+{
+    if(bits == 8) return GetFlacInterleaver<8>(channels);
+    if(bits == 16) return GetFlacInterleaver<16>(channels);
+    if(bits == 24) return GetFlacInterleaver<24>(channels);
+    return InterleaveFlacAny;
+}
+
+
 class FlacDecoder : public Decoder {
     UniquePtr<std::istream> mFile;
 
@@ -21,35 +212,21 @@ class FlacDecoder : public Decoder {
     ALuint mFrameSize;
     uint64_t mSamplePos;
 
+    // The stream's format, as found in the first frame. The interleaver is
+    // picked for it then, so each frame goes straight to its kernel.
+    ALuint mChannels;
+    ALuint mBits;
+    FlacInterleaver mInterleave;
+
+    // Samples decoded past the end of the last read, to return from mDataPos
+    // with the next.
     Vector<ALubyte> mData;
+    size_t mDataPos;
 
     ALubyte *mOutBytes;
     ALuint mOutMax;
     ALuint mOutLen;
 
-    void CopySamples(ALubyte *output, ALuint todo, const FLAC__Frame *frame, const FLAC__int32 *const buffer[], ALuint offset)
-    {
-        if(mSampleType == SampleType::UInt8)
-        {
-            ALubyte *samples = output;
-            for(ALuint c = 0;c < frame->header.channels;c++)
-            {
-                for(ALuint i = 0;i < todo;i++)
-                    samples[i*frame->header.channels + c] = ALubyte(buffer[c][offset+i] + 0x80);
-            }
-        }
-        else
-        {
-            int shift = frame->header.bits_per_sample - 16;
-            ALshort *samples = reinterpret_cast<ALshort*>(output);
-            for(ALuint c = 0;c < frame->header.channels;c++)
-            {
-                for(ALuint i = 0;i < todo;i++)
-                    samples[i*frame->header.channels + c] = buffer[c][offset+i] >> shift;
-            }
-        }
-    }
-
     static FLAC__StreamDecoderWriteStatus WriteCallback(const FLAC__StreamDecoder*, const FLAC__Frame *frame, const FLAC__int32 *const buffer[], void *client_data)
     {
         FlacDecoder *self = static_cast<FlacDecoder*>(client_data);
@@ -60,26 +237,33 @@ class FlacDecoder : public Decoder {
             if(bps == 8)
                 self->mSampleType = SampleType::UInt8;
             else
-            {
                 self->mSampleType = SampleType::Int16;
-                bps = 16;
-            }
 
-            if(frame->header.channels == 1)
-                self->mChannelConfig = ChannelConfig::Mono;
-            else if(frame->header.channels == 2)
-                self->mChannelConfig = ChannelConfig::Stereo;
-            else
-                return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+            // FLAC's channel orders for these counts match OpenAL's.
+            switch(frame->header.channels)
+            {
+                case 1: self->mChannelConfig = ChannelConfig::Mono; break;
+                case 2: self->mChannelConfig = ChannelConfig::Stereo; break;
+                case 4: self->mChannelConfig = ChannelConfig::Quad; break;
+                case 6: self->mChannelConfig = ChannelConfig::X51; break;
+                case 7: self->mChannelConfig = ChannelConfig::X61; break;
+                case 8: self->mChannelConfig = ChannelConfig::X71; break;
+                default: return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+            }
 
-            self->mFrameSize = frame->header.channels * bps/8;
+            self->mChannels = frame->header.channels;
+            self->mBits = bps;
+            self->mInterleave = GetFlacInterleaver(self->mChannels, self->mBits);
+            self->mFrameSize = FramesToBytes(1, self->mChannelConfig, self->mSampleType);
             self->mFrequency = frame->header.sample_rate;
         }
+        else if(frame->header.channels != self->mChannels || frame->header.bits_per_sample != self->mBits)
+            return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 
         ALubyte *data = self->mOutBytes + self->mOutLen;
         ALuint todo = std::min<ALuint>((self->mOutMax-self->mOutLen) / self->mFrameSize,
                                        frame->header.blocksize);
-        self->CopySamples(data, todo, frame, buffer, 0);
+        self->mInterleave(data, buffer, 0, todo, self->mChannels, self->mBits);
         self->mOutLen += self->mFrameSize * todo;
 
         if(todo < frame->header.blocksize)
@@ -88,12 +272,12 @@ class FlacDecoder : public Decoder {
             todo = frame->header.blocksize - todo;
 
             ALuint blocklen = todo * self->mFrameSize;
-            ALuint start = self->mData.size();
+            size_t start = self->mData.size();
 
             self->mData.resize(start+blocklen);
             data = &self->mData[start];
 
-            self->CopySamples(data, todo, frame, buffer, offset);
+            self->mInterleave(data, buffer, offset, todo, self->mChannels, self->mBits);
         }
 
         return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
@@ -162,7 +346,8 @@ class FlacDecoder : public Decoder {
 public:
     FlacDecoder()
       : mFlacFile(nullptr), mChannelConfig(ChannelConfig::Mono), mSampleType(SampleType::Int16)
-      , mFrequency(0), mFrameSize(0), mSamplePos(0), mOutBytes(nullptr), mOutMax(0), mOutLen(0)
+      , mFrequency(0), mFrameSize(0), mSamplePos(0), mChannels(0), mBits(0), mInterleave(nullptr)
+      , mDataPos(0), mOutBytes(nullptr), mOutMax(0), mOutLen(0)
     { }
     ~FlacDecoder() override final;
 
@@ -249,6 +434,12 @@ uint64_t FlacDecoder::getPosition() const
 
 bool FlacDecoder::seek(uint64_t pos)
 {
+    // Anything decoded ahead is from the old position, and the frame seeked
+    // to mustn't go to the last read's output.
+    mData.clear();
+    mDataPos = 0;
+    mOutBytes = nullptr;
+    mOutMax = mOutLen = 0;
     if(!FLAC__stream_decoder_seek_absolute(mFlacFile, pos))
         return false;
     mSamplePos = pos;
@@ -266,12 +457,18 @@ ALuint FlacDecoder::read(ALvoid *ptr, ALuint count)
     mOutLen = 0;
     mOutMax = count * mFrameSize;
 
-    if(mData.size() > 0)
+    if(mDataPos < mData.size())
     {
-        size_t rem = std::min(mData.size(), (size_t)mOutMax);
-        memcpy(ptr, &mData[0], rem);
+        size_t rem = std::min(mData.size()-mDataPos, (size_t)mOutMax);
+        memcpy(ptr, &mData[mDataPos], rem);
         mOutLen += rem;
-        mData.erase(mData.begin(), mData.begin()+rem);
+        mDataPos += rem;
+    }
+    // Once it's all been read, new frames decode straight into the output.
+    if(mDataPos == mData.size())
+    {
+        mData.clear();
+        mDataPos = 0;
     }
 
     while(mOutLen < mOutMax)
@@ -4,6 +4,8 @@
 #include <stdexcept>
 #include <iostream>
 
+#include "main.h"
+
 #include "mpg123.h"
 
 namespace alure
@@ -35,10 +37,12 @@ class Mpg123Decoder : public Decoder {
     mpg123_handle *mMpg123;
     int mChannels;
     long mSampleRate;
+    SampleType mSampleType;
 
 public:
-    Mpg123Decoder(UniquePtr<std::istream> file, mpg123_handle *mpg123, int chans, long srate)
+    Mpg123Decoder(UniquePtr<std::istream> file, mpg123_handle *mpg123, int chans, long srate, SampleType stype)
       : mFile(std::move(file)), mMpg123(mpg123), mChannels(chans), mSampleRate(srate)
+      , mSampleType(stype)
     { }
     ~Mpg123Decoder() override final;
 
@@ -79,7 +83,7 @@ ChannelConfig Mpg123Decoder::getChannelConfig() const
 
 SampleType Mpg123Decoder::getSampleType() const
 {
-    return SampleType::Int16;
+    return mSampleType;
 }
 
 
@@ -110,7 +114,8 @@ std::pair<uint64_t,uint64_t> Mpg123Decoder::getLoopPoints() const
 ALuint Mpg123Decoder::read(ALvoid *ptr, ALuint count)
 {
     unsigned char *dst = reinterpret_cast<unsigned char*>(ptr);
-    ALuint bytes = count * mChannels * 2;
+    ALuint framesize = FramesToBytes(1, getChannelConfig(), mSampleType);
+    ALuint bytes = count * framesize;
     ALuint total = 0;
     while(total < bytes)
     {
@@ -123,7 +128,7 @@ ALuint Mpg123Decoder::read(ALvoid *ptr, ALuint count)
         if(ret == MPG123_DONE)
             break;
     }
-    return total / mChannels / 2;
+    return total / framesize;
 }
 
 
@@ -162,11 +167,20 @@ SharedPtr<Decoder> Mpg123DecoderFactory::createDecoder(UniquePtr<std::istream> &
             if(mpg123_getformat(mpg123, &srate, &channels, &enc) == MPG123_OK)
             {
                 if((channels == 1 || channels == 2) && srate > 0 &&
-                   mpg123_format_none(mpg123) == MPG123_OK &&
-                   mpg123_format(mpg123, srate, channels, MPG123_ENC_SIGNED_16) == MPG123_OK)
+                   mpg123_format_none(mpg123) == MPG123_OK)
                 {
-                    // All OK
-                    return MakeShared<Mpg123Decoder>(std::move(file), mpg123, channels, srate);
+                    // Use float output if preferred and mpg123 was built with
+                    // it, else 16-bit.
+                    if(GetPreferredSampleType() == SampleType::Float32 &&
+                       mpg123_format(mpg123, srate, channels, MPG123_ENC_FLOAT_32) == MPG123_OK)
+                        return MakeShared<Mpg123Decoder>(std::move(file), mpg123, channels, srate,
+                                                         SampleType::Float32);
+                    if(mpg123_format(mpg123, srate, channels, MPG123_ENC_SIGNED_16) == MPG123_OK)
+                    {
+                        // All OK
+                        return MakeShared<Mpg123Decoder>(std::move(file), mpg123, channels, srate,
+                                                         SampleType::Int16);
+                    }
                 }
             }
             mpg123_close(mpg123);
@@ -6,6 +6,7 @@
 #include <limits>
 
 #include "buffer.h"
+#include "chanmap.h"
 
 #include "opusfile.h"
 
@@ -54,10 +55,12 @@ class OpusFileDecoder : public Decoder {
     int mOggBitstream;
 
     ChannelConfig mChannelConfig;
+    SampleType mSampleType;
 
 public:
-    OpusFileDecoder(UniquePtr<std::istream> file, OggOpusFile *oggfile, ChannelConfig sconfig)
+    OpusFileDecoder(UniquePtr<std::istream> file, OggOpusFile *oggfile, ChannelConfig sconfig, SampleType stype)
       : mFile(std::move(file)), mOggFile(oggfile), mOggBitstream(0), mChannelConfig(sconfig)
+      , mSampleType(stype)
     { }
     ~OpusFileDecoder() override final;
 
@@ -93,7 +96,7 @@ ChannelConfig OpusFileDecoder::getChannelConfig() const
 
 SampleType OpusFileDecoder::getSampleType() const
 {
-    return SampleType::Int16;
+    return mSampleType;
 }
 
 
@@ -122,62 +125,44 @@ std::pair<uint64_t,uint64_t> OpusFileDecoder::getLoopPoints() const
 ALuint OpusFileDecoder::read(ALvoid *ptr, ALuint count)
 {
     ALuint total = 0;
-    opus_int16 *samples = (opus_int16*)ptr;
     int num_chans = FramesToBytes(1, mChannelConfig, SampleType::UInt8);
-    while(total < count)
+    if(mSampleType == SampleType::Float32)
     {
-        if(num_chans != op_head(mOggFile, -1)->channel_count)
-            break;
-        int len = (count-total) * num_chans;
-
-        long got = op_read(mOggFile, samples, len, &mOggBitstream);
-        if(got <= 0) break;
+        float *samples = (float*)ptr;
+        while(total < count)
+        {
+            if(num_chans != op_head(mOggFile, -1)->channel_count)
+                break;
+            int len = (count-total) * num_chans;
 
-        samples += got*num_chans;
-        total += got;
-    }
+            long got = op_read_float(mOggFile, samples, len, &mOggBitstream);
+            if(got <= 0) break;
 
-    // 1, 2, and 4 channel files decode into the same channel order as
-    // OpenAL, however 6 (5.1), 7 (6.1), and 8 (7.1) channel files need to be
-    // re-ordered.
-    if(mChannelConfig == ChannelConfig::X51)
-    {
-        samples = (opus_int16*)ptr;
-        for(ALuint i = 0;i < total;++i)
-        {
-            // OpenAL : FL, FR, FC, LFE, RL, RR
-            // Opus   : FL, FC, FR,  RL, RR, LFE
-            std::swap(samples[i*6 + 1], samples[i*6 + 2]);
-            std::swap(samples[i*6 + 3], samples[i*6 + 5]);
-            std::swap(samples[i*6 + 4], samples[i*6 + 5]);
-        }
-    }
-    else if(mChannelConfig == ChannelConfig::X61)
-    {
-        samples = (opus_int16*)ptr;
-        for(ALuint i = 0;i < total;++i)
-        {
-            // OpenAL : FL, FR, FC, LFE, RC, SL, SR
-            // Opus   : FL, FC, FR,  SL, SR, RC, LFE
-            std::swap(samples[i*7 + 1], samples[i*7 + 2]);
-            std::swap(samples[i*7 + 3], samples[i*7 + 6]);
-            std::swap(samples[i*7 + 4], samples[i*7 + 5]);
-            std::swap(samples[i*7 + 5], samples[i*7 + 6]);
+            samples += got*num_chans;
+            total += got;
         }
+
+        if(const ChannelMap *chanmap = GetVorbisChannelMap(mChannelConfig))
+            PermuteChannels(static_cast<ALfloat*>(ptr), total, *chanmap);
     }
-    else if(mChannelConfig == ChannelConfig::X71)
+    else
     {
-        samples = (opus_int16*)ptr;
-        for(ALuint i = 0;i < total;++i)
+        opus_int16 *samples = (opus_int16*)ptr;
+        while(total < count)
         {
-            // OpenAL : FL, FR, FC, LFE, RL, RR, SL, SR
-            // Opus   : FL, FC, FR,  SL, SR, RL, RR, LFE
-            std::swap(samples[i*8 + 1], samples[i*8 + 2]);
-            std::swap(samples[i*8 + 3], samples[i*8 + 7]);
-            std::swap(samples[i*8 + 4], samples[i*8 + 5]);
-            std::swap(samples[i*8 + 5], samples[i*8 + 6]);
-            std::swap(samples[i*8 + 6], samples[i*8 + 7]);
+            if(num_chans != op_head(mOggFile, -1)->channel_count)
+                break;
+            int len = (count-total) * num_chans;
+
+            long got = op_read(mOggFile, samples, len, &mOggBitstream);
+            if(got <= 0) break;
+
+            samples += got*num_chans;
+            total += got;
         }
+
+        if(const ChannelMap *chanmap = GetVorbisChannelMap(mChannelConfig))
+            PermuteChannels(static_cast<ALshort*>(ptr), total, *chanmap);
     }
 
     return total;
@@ -213,7 +198,11 @@ SharedPtr<Decoder> OpusFileDecoderFactory::createDecoder(UniquePtr<std::istream>
         return nullptr;
     }
 
-    return MakeShared<OpusFileDecoder>(std::move(file), oggfile, channels);
+    SampleType type = SampleType::Int16;
+    if(GetPreferredSampleType() == SampleType::Float32)
+        type = SampleType::Float32;
+
+    return MakeShared<OpusFileDecoder>(std::move(file), oggfile, channels, type);
 }
 
 }
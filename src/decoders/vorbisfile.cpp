@@ -4,6 +4,8 @@
 #include <stdexcept>
 #include <iostream>
 
+#include "chanmap.h"
+
 #include "vorbis/vorbisfile.h"
 
 namespace alure
@@ -57,11 +59,14 @@ class VorbisFileDecoder : public Decoder {
     int mOggBitstream;
 
     ChannelConfig mChannelConfig;
+    SampleType mSampleType;
+
+    ALuint readFloat(ALfloat *samples, ALuint count);
 
 public:
-    VorbisFileDecoder(UniquePtr<std::istream> file, UniquePtr<OggVorbis_File> oggfile, vorbis_info *vorbisinfo, ChannelConfig sconfig)
+    VorbisFileDecoder(UniquePtr<std::istream> file, UniquePtr<OggVorbis_File> oggfile, vorbis_info *vorbisinfo, ChannelConfig sconfig, SampleType stype)
       : mFile(std::move(file)), mOggFile(std::move(oggfile)), mVorbisInfo(vorbisinfo)
-      , mOggBitstream(0), mChannelConfig(sconfig)
+      , mOggBitstream(0), mChannelConfig(sconfig), mSampleType(stype)
     { }
     ~VorbisFileDecoder() override final;
 
@@ -96,7 +101,7 @@ ChannelConfig VorbisFileDecoder::getChannelConfig() const
 
 SampleType VorbisFileDecoder::getSampleType() const
 {
-    return SampleType::Int16;
+    return mSampleType;
 }
 
 
@@ -122,8 +127,36 @@ std::pair<uint64_t,uint64_t> VorbisFileDecoder::getLoopPoints() const
     return std::make_pair(0, 0);
 }
 
+ALuint VorbisFileDecoder::readFloat(ALfloat *samples, ALuint count)
+{
+    // Float samples come out planar, so reorder the channels while
+    // interleaving them.
+    const ChannelMap *chanmap = GetVorbisChannelMap(mChannelConfig);
+    ALuint channels = mVorbisInfo->channels;
+    ALuint total = 0;
+    while(total < count)
+    {
+        float **pcm;
+        long got = ov_read_float(mOggFile.get(), &pcm, count-total, &mOggBitstream);
+        if(got <= 0) break;
+
+        for(ALuint c = 0;c < channels;c++)
+        {
+            const float *src = pcm[chanmap ? chanmap->mOrder[c] : c];
+            for(long i = 0;i < got;i++)
+                samples[i*channels + c] = src[i];
+        }
+        samples += got*channels;
+        total += got;
+    }
+    return total;
+}
+
 ALuint VorbisFileDecoder::read(ALvoid *ptr, ALuint count)
 {
+    if(mSampleType == SampleType::Float32)
+        return readFloat(static_cast<ALfloat*>(ptr), count);
+
     ALuint total = 0;
     ALshort *samples = (ALshort*)ptr;
     while(total < count)
@@ -142,48 +175,8 @@ ALuint VorbisFileDecoder::read(ALvoid *ptr, ALuint count)
         total += got;
     }
 
-    // 1, 2, and 4 channel files decode into the same channel order as
-    // OpenAL, however 6 (5.1), 7 (6.1), and 8 (7.1) channel files need to be
-    // re-ordered.
-    if(mChannelConfig == ChannelConfig::X51)
-    {
-        samples = (ALshort*)ptr;
-        for(ALuint i = 0;i < total;++i)
-        {
-            // OpenAL : FL, FR, FC, LFE, RL, RR
-            // Vorbis : FL, FC, FR,  RL, RR, LFE
-            std::swap(samples[i*6 + 1], samples[i*6 + 2]);
-            std::swap(samples[i*6 + 3], samples[i*6 + 5]);
-            std::swap(samples[i*6 + 4], samples[i*6 + 5]);
-        }
-    }
-    else if(mChannelConfig == ChannelConfig::X61)
-    {
-        samples = (ALshort*)ptr;
-        for(ALuint i = 0;i < total;++i)
-        {
-            // OpenAL : FL, FR, FC, LFE, RC, SL, SR
-            // Vorbis : FL, FC, FR,  SL, SR, RC, LFE
-            std::swap(samples[i*7 + 1], samples[i*7 + 2]);
-            std::swap(samples[i*7 + 3], samples[i*7 + 6]);
-            std::swap(samples[i*7 + 4], samples[i*7 + 5]);
-            std::swap(samples[i*7 + 5], samples[i*7 + 6]);
-        }
-    }
-    else if(mChannelConfig == ChannelConfig::X71)
-    {
-        samples = (ALshort*)ptr;
-        for(ALuint i = 0;i < total;++i)
-        {
-            // OpenAL : FL, FR, FC, LFE, RL, RR, SL, SR
-            // Vorbis : FL, FC, FR,  SL, SR, RL, RR, LFE
-            std::swap(samples[i*8 + 1], samples[i*8 + 2]);
-            std::swap(samples[i*8 + 3], samples[i*8 + 7]);
-            std::swap(samples[i*8 + 4], samples[i*8 + 5]);
-            std::swap(samples[i*8 + 5], samples[i*8 + 6]);
-            std::swap(samples[i*8 + 6], samples[i*8 + 7]);
-        }
-    }
+    if(const ChannelMap *chanmap = GetVorbisChannelMap(mChannelConfig))
+        PermuteChannels(static_cast<ALshort*>(ptr), total, *chanmap);
 
     return total;
 }
@@ -226,8 +219,12 @@ SharedPtr<Decoder> VorbisFileDecoderFactory::createDecoder(UniquePtr<std::istrea
         return nullptr;
     }
 
+    SampleType type = SampleType::Int16;
+    if(GetPreferredSampleType() == SampleType::Float32)
+        type = SampleType::Float32;
+
     return MakeShared<VorbisFileDecoder>(
-        std::move(file), std::move(oggfile), vorbisinfo, channels
+        std::move(file), std::move(oggfile), vorbisinfo, channels, type
     );
 }
 
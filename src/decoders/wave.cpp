@@ -6,6 +6,7 @@
 #include <cstring>
 
 #include "buffer.h"
+#include "memstream.h"
 
 
 namespace alure
@@ -58,6 +59,8 @@ static ALushort read_le16(std::istream &stream)
 
 class WaveDecoder : public Decoder {
     UniquePtr<std::istream> mFile;
+    // Set if the file is in memory, to read from it directly
+    MemoryStreamBuf *mMemory;
 
     ChannelConfig mChannelConfig;
     SampleType mSampleType;
@@ -73,7 +76,7 @@ class WaveDecoder : public Decoder {
 public:
     WaveDecoder(UniquePtr<std::istream> file, ChannelConfig channels, SampleType type, ALuint frequency, ALuint framesize,
                 std::istream::pos_type start, std::istream::pos_type end, ALuint loopstart, ALuint loopend)
-      : mFile(std::move(file)), mChannelConfig(channels), mSampleType(type), mFrequency(frequency)
+      : mFile(std::move(file)), mMemory(MemoryStream::GetBuffer(*mFile)), mChannelConfig(channels), mSampleType(type), mFrequency(frequency)
       , mFrameSize(framesize), mLoopPts{loopstart,loopend}, mStart(start), mEnd(end)
     { }
     ~WaveDecoder() override final;
@@ -139,6 +142,22 @@ std::pair<uint64_t,uint64_t> WaveDecoder::getLoopPoints() const
 
 ALuint WaveDecoder::read(ALvoid *ptr, ALuint count)
 {
+#ifndef __BIG_ENDIAN__
+    if(mMemory)
+    {
+        size_t pos = mMemory->tell();
+        // The data chunk's size comes from the header, so don't trust it to
+        // fit in the file.
+        size_t end = std::min<size_t>(static_cast<std::streamoff>(mEnd), mMemory->size());
+        if(pos >= end) return 0;
+
+        size_t len = std::min<size_t>(count, (end-pos) / mFrameSize);
+        memcpy(ptr, mMemory->data()+pos, len*mFrameSize);
+        mMemory->skip(len*mFrameSize);
+        return len;
+    }
+#endif
+
     mFile->clear();
 
     auto pos = mFile->tellg();
@@ -36,6 +36,12 @@ static void LoadHrtf(ALDevice *device)
     LoadALCFunc(device->getDevice(), &device->alcResetDeviceSOFT, "alcResetDeviceSOFT");
 }
 
+static void LoadLoopback(ALDevice *device)
+{
+    LoadALCFunc(device->getDevice(), &device->alcIsRenderFormatSupportedSOFT, "alcIsRenderFormatSupportedSOFT");
+    LoadALCFunc(device->getDevice(), &device->alcRenderSamplesSOFT, "alcRenderSamplesSOFT");
+}
+
 static void LoadNothing(ALDevice*) { }
 
 static const struct {
@@ -46,9 +52,33 @@ static const struct {
     { EXT_thread_local_context, "ALC_EXT_thread_local_context", LoadNothing },
     { SOFT_device_pause, "ALC_SOFT_pause_device", LoadPauseDevice },
     { SOFT_HRTF, "ALC_SOFT_HRTF", LoadHrtf },
+    { SOFT_loopback, "ALC_SOFT_loopback", LoadLoopback },
 };
 
 
+static ALCuint RenderFrameSize(ALCint channels, ALCint type)
+{
+    ALCuint size;
+    switch(type)
+    {
+        case ALC_BYTE_SOFT: case ALC_UNSIGNED_BYTE_SOFT: size = 1; break;
+        case ALC_SHORT_SOFT: case ALC_UNSIGNED_SHORT_SOFT: size = 2; break;
+        case ALC_INT_SOFT: case ALC_UNSIGNED_INT_SOFT: case ALC_FLOAT_SOFT: size = 4; break;
+        default: throw std::runtime_error("Invalid render sample type");
+    }
+    switch(channels)
+    {
+        case ALC_MONO_SOFT: return size;
+        case ALC_STEREO_SOFT: return size * 2;
+        case ALC_QUAD_SOFT: return size * 4;
+        case ALC_5POINT1_SOFT: return size * 6;
+        case ALC_6POINT1_SOFT: return size * 7;
+        case ALC_7POINT1_SOFT: return size * 8;
+    }
+    throw std::runtime_error("Invalid render channel configuration");
+}
+
+
 void ALDevice::setupExts()
 {
     std::fill(std::begin(mHasExt), std::end(mHasExt), false);
@@ -60,8 +90,10 @@ void ALDevice::setupExts()
 }
 
 
-ALDevice::ALDevice(ALCdevice* device)
-  : mDevice(device), alcDevicePauseSOFT(nullptr), alcDeviceResumeSOFT(nullptr)
+ALDevice::ALDevice(ALCdevice* device, bool loopback)
+  : mDevice(device), mIsLoopback(loopback), mRenderFrequency(0), mRenderFrameSize(0),
+    mRenderedFrames(0), alcDevicePauseSOFT(nullptr), alcDeviceResumeSOFT(nullptr),
+    alcIsRenderFormatSupportedSOFT(nullptr), alcRenderSamplesSOFT(nullptr)
 {
     setupExts();
 }
@@ -215,8 +247,48 @@ void ALDevice::reset(const Vector<AttributePair> &attributes)
 }
 
 
-Context *ALDevice::createContext(const Vector<AttributePair> &attributes)
+Vector<AttributePair> ALDevice::getRenderAttributes(const Vector<AttributePair> &attributes)
+{
+    Vector<AttributePair> attrs;
+    ALCint freq = 0, channels = 0, type = 0;
+    for(const AttributePair &attr : attributes)
+    {
+        if(std::get<0>(attr) == 0)
+            break;
+        if(std::get<0>(attr) == ALC_FREQUENCY)
+            freq = std::get<1>(attr);
+        else if(std::get<0>(attr) == ALC_FORMAT_CHANNELS_SOFT)
+            channels = std::get<1>(attr);
+        else if(std::get<0>(attr) == ALC_FORMAT_TYPE_SOFT)
+            type = std::get<1>(attr);
+        else
+            attrs.push_back(attr);
+    }
+
+    // Default to 44.1khz stereo, with float samples if they're supported.
+    if(!freq) freq = 44100;
+    if(!channels) channels = ALC_STEREO_SOFT;
+    if(!type)
+        type = alcIsRenderFormatSupportedSOFT(mDevice, freq, channels, ALC_FLOAT_SOFT) ?
+               ALC_FLOAT_SOFT : ALC_SHORT_SOFT;
+    if(freq <= 0 || !alcIsRenderFormatSupportedSOFT(mDevice, freq, channels, type))
+        throw std::runtime_error("Render format not supported");
+
+    mRenderFrameSize = RenderFrameSize(channels, type);
+    mRenderFrequency = freq;
+
+    attrs.push_back({ALC_FREQUENCY, freq});
+    attrs.push_back({ALC_FORMAT_CHANNELS_SOFT, channels});
+    attrs.push_back({ALC_FORMAT_TYPE_SOFT, type});
+    attrs.push_back({0, 0});
+    return attrs;
+}
+
+Context *ALDevice::createContext(const Vector<AttributePair> &ctxattrs)
 {
+    // Loopback devices need a render format, so fill in any that's missing.
+    const Vector<AttributePair> &attributes = mIsLoopback ?
+        getRenderAttributes(ctxattrs) : ctxattrs;
     ALCcontext *ctx = [this, &attributes]() -> ALCcontext*
     {
         if(attributes.empty())
@@ -241,7 +313,18 @@ Context *ALDevice::createContext(const Vector<AttributePair> &attributes)
     }();
     if(!ctx) throw std::runtime_error("Failed to create context");
 
-    mContexts.emplace_back(MakeUnique<ALContext>(ctx, this));
+    // Requested source counts are generated ahead of time, so the first sounds
+    // played don't have to.
+    ALuint initsources = 0;
+    for(const AttributePair &attr : attributes)
+    {
+        if(std::get<0>(attr) == 0)
+            break;
+        if(std::get<0>(attr) == ALC_MONO_SOURCES || std::get<0>(attr) == ALC_STEREO_SOURCES)
+            initsources += std::max(std::get<1>(attr), 0);
+    }
+
+    mContexts.emplace_back(MakeUnique<ALContext>(ctx, this, initsources));
     return mContexts.back().get();
 }
 
@@ -260,6 +343,40 @@ void ALDevice::resumeDSP()
 }
 
 
+void ALDevice::renderSamples(ALvoid *buffer, ALCsizei frames)
+{
+    if(!mIsLoopback)
+        throw std::runtime_error("Not a loopback device");
+    if(!mRenderFrameSize)
+        throw std::runtime_error("No render format set");
+
+    // Only the current context can be updated, since that's where OpenAL
+    // calls go.
+    ALContext *ctx = ALContext::GetCurrent();
+    if(ctx && ctx->getDevice() != this)
+        ctx = nullptr;
+
+    // Render one device update at a time, refilling streams and applying
+    // source changes in between, as the background thread would when playing
+    // in real time.
+    ALCint refresh = 0;
+    alcGetIntegerv(mDevice, ALC_REFRESH, 1, &refresh);
+    if(refresh <= 0) refresh = 50;
+    ALCsizei period = std::max<ALCsizei>(mRenderFrequency / refresh, 1);
+
+    ALbyte *dst = static_cast<ALbyte*>(buffer);
+    while(frames > 0)
+    {
+        ALCsizei todo = std::min(frames, period);
+        if(ctx) ctx->renderUpdate();
+        alcRenderSamplesSOFT(mDevice, dst, todo);
+        mRenderedFrames += todo;
+        dst += todo * mRenderFrameSize;
+        frames -= todo;
+    }
+}
+
+
 void ALDevice::close()
 {
     if(!mContexts.empty())
@@ -5,6 +5,7 @@
 
 #include <map>
 #include <mutex>
+#include <chrono>
 
 #include "alc.h"
 #include "alext.h"
@@ -20,6 +21,7 @@ enum ALCExtension {
     EXT_thread_local_context,
     SOFT_device_pause,
     SOFT_HRTF,
+    SOFT_loopback,
 
     ALC_EXTENSION_MAX
 };
@@ -31,11 +33,19 @@ class ALDevice : public Device {
 
     bool mHasExt[ALC_EXTENSION_MAX];
 
+    // Loopback devices render on request, at the format given when creating
+    // a context. The frames rendered so far stand in for the clock.
+    const bool mIsLoopback;
+    ALCuint mRenderFrequency;
+    ALCuint mRenderFrameSize;
+    uint64_t mRenderedFrames;
+    Vector<AttributePair> getRenderAttributes(const Vector<AttributePair> &attributes);
+
     std::once_flag mSetExts;
     void setupExts();
 
 public:
-    ALDevice(ALCdevice *device);
+    ALDevice(ALCdevice *device, bool loopback);
     virtual ~ALDevice();
 
     ALCdevice *getDevice() const { return mDevice; }
@@ -48,6 +58,23 @@ public:
     LPALCGETSTRINGISOFT alcGetStringiSOFT;
     LPALCRESETDEVICESOFT alcResetDeviceSOFT;
 
+    LPALCISRENDERFORMATSUPPORTEDSOFT alcIsRenderFormatSupportedSOFT;
+    LPALCRENDERSAMPLESSOFT alcRenderSamplesSOFT;
+
+    // The time since the device opened, measured by the audio rendered for
+    // loopback devices, so playback timing doesn't depend on how fast it's
+    // rendered.
+    std::chrono::steady_clock::time_point getClockTime() const
+    {
+        if(!mIsLoopback)
+            return std::chrono::steady_clock::now();
+        uint64_t secs = mRenderedFrames / mRenderFrequency;
+        uint64_t rem = mRenderedFrames % mRenderFrequency;
+        return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::seconds(secs) + std::chrono::nanoseconds(rem * 1000000000 / mRenderFrequency)
+        ));
+    }
+
     void removeContext(ALContext *ctx);
 
     String getName(PlaybackDeviceName type) const override final;
@@ -70,6 +97,9 @@ public:
     void pauseDSP() override final;
     void resumeDSP() override final;
 
+    bool isLoopback() const override final { return mIsLoopback; }
+    void renderSamples(ALvoid *buffer, ALCsizei frames) override final;
+
     void close() override final;
 };
 
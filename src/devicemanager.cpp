@@ -21,6 +21,7 @@ static inline void GetDeviceProc(T **func, ALCdevice *device, const char *name)
 
 
 ALCboolean (ALC_APIENTRY*ALDeviceManager::SetThreadContext)(ALCcontext*);
+ALCdevice* (ALC_APIENTRY*ALDeviceManager::LoopbackOpenDevice)(const ALCchar*);
 
 DeviceManager &DeviceManager::get()
 {
@@ -39,6 +40,8 @@ ALDeviceManager::ALDeviceManager()
 {
     if(alcIsExtensionPresent(0, "ALC_EXT_thread_local_context"))
         GetDeviceProc(&SetThreadContext, 0, "alcSetThreadContext");
+    if(alcIsExtensionPresent(0, "ALC_SOFT_loopback"))
+        GetDeviceProc(&LoopbackOpenDevice, 0, "alcLoopbackOpenDeviceSOFT");
 }
 
 ALDeviceManager::~ALDeviceManager()
@@ -83,7 +86,18 @@ Device *ALDeviceManager::openPlayback(const String &name)
             throw std::runtime_error("Failed to open default device");
         throw std::runtime_error("Failed to open device \""+name+"\"");
     }
-    mDevices.emplace_back(MakeUnique<ALDevice>(dev));
+    mDevices.emplace_back(MakeUnique<ALDevice>(dev, false));
+    return mDevices.back().get();
+}
+
+Device *ALDeviceManager::openLoopback()
+{
+    if(!LoopbackOpenDevice)
+        throw std::runtime_error("ALC_SOFT_loopback not supported");
+    ALCdevice *dev = LoopbackOpenDevice(nullptr);
+    if(!dev)
+        throw std::runtime_error("Failed to open loopback device");
+    mDevices.emplace_back(MakeUnique<ALDevice>(dev, true));
     return mDevices.back().get();
 }
 
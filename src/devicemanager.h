@@ -15,6 +15,7 @@ class ALDeviceManager : public DeviceManager {
 
 public:
     static ALCboolean (ALC_APIENTRY*SetThreadContext)(ALCcontext*);
+    static ALCdevice* (ALC_APIENTRY*LoopbackOpenDevice)(const ALCchar*);
 
     static ALDeviceManager &get();
 
@@ -26,6 +27,7 @@ public:
     String defaultDeviceName(DefaultDeviceType type) const override final;
 
     Device *openPlayback(const String &name) override final;
+    Device *openLoopback() override final;
 };
 
 } // namespace alure
@@ -14,6 +14,17 @@ inline T cast(T2 obj)
 { return obj ? dynamic_cast<T>(obj) : 0; }
 #endif
 
+/* The sample type the built-in decoders should output when they're able to.
+ * This is the creating context's preference while it creates a decoder, and
+ * Int16 otherwise.
+ */
+SampleType GetPreferredSampleType();
+
+/* Creates a decoder for the file from the registered decoder factories, then
+ * the built-in ones. Sets factoryname to the name of the one that opened it.
+ */
+SharedPtr<Decoder> GetDecoder(const String &name, UniquePtr<std::istream> file, String &factoryname);
+
 } // namespace alure
 
 #endif /* ALURE_MAIN_H */
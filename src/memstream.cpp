@@ -0,0 +1,221 @@
+
+#include "config.h"
+
+#include "memstream.h"
+
+#include <limits>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace alure
+{
+
+FileMapping::FileMapping()
+  : mData(nullptr), mSize(0)
+#ifdef _WIN32
+  , mMapHandle(nullptr)
+#endif
+{ }
+
+#ifdef _WIN32
+
+FileMapping::~FileMapping()
+{
+    if(mData) UnmapViewOfFile(mData);
+    if(mMapHandle) CloseHandle(mMapHandle);
+}
+
+SharedPtr<FileMapping> FileMapping::Open(const String &name)
+{
+    SharedPtr<FileMapping> ret;
+
+    HANDLE file = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return ret;
+
+    LARGE_INTEGER fsize;
+    if(!GetFileSizeEx(file, &fsize) || fsize.QuadPart <= 0 ||
+       static_cast<uint64_t>(fsize.QuadPart) > std::numeric_limits<size_t>::max())
+    {
+        CloseHandle(file);
+        return ret;
+    }
+
+    ret.reset(new FileMapping());
+    ret->mMapHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if(!ret->mMapHandle)
+        return nullptr;
+
+    ret->mData = static_cast<const char*>(MapViewOfFile(ret->mMapHandle, FILE_MAP_READ, 0, 0, 0));
+    if(!ret->mData)
+        return nullptr;
+    ret->mSize = static_cast<size_t>(fsize.QuadPart);
+
+    return ret;
+}
+
+#else
+
+FileMapping::~FileMapping()
+{
+    if(mData) munmap(const_cast<char*>(mData), mSize);
+}
+
+SharedPtr<FileMapping> FileMapping::Open(const String &name)
+{
+    SharedPtr<FileMapping> ret;
+
+    int fd = open(name.c_str(), O_RDONLY);
+    if(fd < 0) return ret;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+       static_cast<uint64_t>(st.st_size) > std::numeric_limits<size_t>::max())
+    {
+        close(fd);
+        return ret;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED)
+        return ret;
+#ifdef POSIX_MADV_SEQUENTIAL
+    posix_madvise(ptr, size, POSIX_MADV_SEQUENTIAL);
+#endif
+
+    ret.reset(new FileMapping());
+    ret->mData = static_cast<const char*>(ptr);
+    ret->mSize = size;
+    return ret;
+}
+
+#endif
+
+
+MemoryStreamBuf::MemoryStreamBuf(const char *data, size_t size)
+{
+    char *ptr = const_cast<char*>(data);
+    setg(ptr, ptr, ptr+size);
+}
+
+MemoryStreamBuf::int_type MemoryStreamBuf::underflow()
+{
+    // The whole span is the get area, so there's never anything to refill.
+    if(gptr() == egptr())
+        return traits_type::eof();
+    return traits_type::to_int_type(*gptr());
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekoff(off_type offset, std::ios_base::seekdir whence, std::ios_base::openmode mode)
+{
+    if((mode&std::ios_base::out) || !(mode&std::ios_base::in))
+        return pos_type(off_type(-1));
+
+    switch(whence)
+    {
+        case std::ios_base::beg:
+            break;
+
+        case std::ios_base::cur:
+            offset += gptr() - eback();
+            break;
+
+        case std::ios_base::end:
+            offset += egptr() - eback();
+            break;
+
+        default:
+            return pos_type(off_type(-1));
+    }
+
+    if(offset < 0 || offset > egptr()-eback())
+        return pos_type(off_type(-1));
+
+    setg(eback(), eback()+offset, egptr());
+    return offset;
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekpos(pos_type pos, std::ios_base::openmode mode)
+{
+    return seekoff(pos, std::ios_base::beg, mode);
+}
+
+
+int MemoryStream::GetIndex()
+{
+    static const int index = std::ios_base::xalloc();
+    return index;
+}
+
+MemoryStream::MemoryStream(const char *data, size_t size, SharedPtr<FileMapping> mapping)
+  : std::istream(nullptr), mStreamBuf(data, size), mMapping(std::move(mapping))
+{
+    init(&mStreamBuf);
+    pword(GetIndex()) = &mStreamBuf;
+}
+
+MemoryStream::MemoryStream(SharedPtr<FileMapping> mapping)
+  : MemoryStream(mapping->data(), mapping->size(), mapping)
+{ }
+
+
+namespace {
+
+int GetPathIndex()
+{
+    static const int index = std::ios_base::xalloc();
+    return index;
+}
+
+// Streams over a whole file, which remember its path.
+class MappedFileStream : public MemoryStream {
+    String mPath;
+
+public:
+    MappedFileStream(SharedPtr<FileMapping> mapping, const String &path)
+      : MemoryStream(std::move(mapping)), mPath(path)
+    { pword(GetPathIndex()) = &mPath; }
+};
+
+class PlainFileStream : public std::ifstream {
+    String mPath;
+
+public:
+    PlainFileStream(const String &path)
+      : std::ifstream(path.c_str(), std::ios::binary), mPath(path)
+    { pword(GetPathIndex()) = &mPath; }
+};
+
+} // namespace
+
+UniquePtr<std::istream> OpenMappedFile(const String &name)
+{
+    if(SharedPtr<FileMapping> mapping = FileMapping::Open(name))
+        return MakeUnique<MappedFileStream>(std::move(mapping), name);
+
+    auto file = MakeUnique<PlainFileStream>(name);
+    if(!file->is_open()) file = nullptr;
+    return std::move(file);
+}
+
+const String *GetFilePath(std::istream &stream)
+{
+    return static_cast<const String*>(stream.pword(GetPathIndex()));
+}
+
+} // namespace alure
@@ -0,0 +1,96 @@
+#ifndef MEMSTREAM_H
+#define MEMSTREAM_H
+
+#include "main.h"
+
+#include <streambuf>
+#include <istream>
+
+namespace alure {
+
+// A read-only view of a file mapped into memory. The mapping is released when
+// the object is destroyed.
+class FileMapping {
+    const char *mData;
+    size_t mSize;
+#ifdef _WIN32
+    void *mMapHandle;
+#endif
+
+    FileMapping();
+
+public:
+    FileMapping(const FileMapping&) = delete;
+    FileMapping& operator=(const FileMapping&) = delete;
+    ~FileMapping();
+
+    /* Maps the whole of the named file. Returns an empty pointer if the file
+     * can't be opened or mapped (e.g. if it's empty or not a regular file).
+     */
+    static SharedPtr<FileMapping> Open(const String &name);
+
+    const char *data() const { return mData; }
+    size_t size() const { return mSize; }
+};
+
+
+/* A read-only stream buffer over a span of memory. The whole span is exposed
+ * as the get area, so reads through an istream are a single copy from memory
+ * and never need to refill.
+ */
+class MemoryStreamBuf : public std::streambuf {
+    int_type underflow() override final;
+    pos_type seekoff(off_type offset, std::ios_base::seekdir whence, std::ios_base::openmode mode) override final;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode mode) override final;
+
+public:
+    MemoryStreamBuf(const char *data, size_t size);
+
+    const char *data() const { return eback(); }
+    size_t size() const { return egptr() - eback(); }
+
+    // The current read offset, and how many bytes remain after it.
+    size_t tell() const { return gptr() - eback(); }
+    size_t remaining() const { return egptr() - gptr(); }
+    // Moves the read offset forward after using the data directly.
+    void skip(size_t count) { setg(eback(), gptr()+count, egptr()); }
+};
+
+
+/* An input stream over a span of memory, optionally keeping a file mapping
+ * alive for as long as the stream exists. Decoders can get at the underlying
+ * memory with GetBuffer, to read from it directly instead of copying through
+ * the stream.
+ */
+class MemoryStream : public std::istream {
+    MemoryStreamBuf mStreamBuf;
+    SharedPtr<FileMapping> mMapping;
+
+    static int GetIndex();
+
+public:
+    MemoryStream(const char *data, size_t size, SharedPtr<FileMapping> mapping=nullptr);
+    MemoryStream(SharedPtr<FileMapping> mapping);
+
+    /* Returns the memory buffer backing the given stream, or nullptr if it's
+     * not a MemoryStream. Works without RTTI.
+     */
+    static MemoryStreamBuf *GetBuffer(std::istream &stream)
+    { return static_cast<MemoryStreamBuf*>(stream.pword(GetIndex())); }
+};
+
+
+/* Opens the named file for reading, mapped into memory when possible so
+ * decoders can read from it directly, or with standard I/O otherwise. Returns
+ * nullptr if it can't be opened.
+ */
+UniquePtr<std::istream> OpenMappedFile(const String &name);
+
+/* Returns the path of the file a stream from OpenMappedFile reads, or nullptr
+ * for other streams. Works without RTTI.
+ */
+const String *GetFilePath(std::istream &stream);
+
+} // namespace alure
+
+#endif /* MEMSTREAM_H */
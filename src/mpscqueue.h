@@ -0,0 +1,95 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include "main.h"
+
+#include <atomic>
+
+namespace alure {
+
+// Base for objects that can be linked into an MpscQueue.
+struct QueueNode {
+    std::atomic<QueueNode*> mQueueNext;
+
+    QueueNode() : mQueueNext(nullptr) { }
+};
+
+
+/* An unbounded, intrusive multi-producer/single-consumer queue (after Dmitry
+ * Vyukov's design). Pushing is a single atomic exchange plus a store, so
+ * producers never wait on each other or on the consumer, and the queue never
+ * fills up. Items are owned by the queue while linked into it.
+ *
+ * Popping must be serialized by the caller, and isn't wait-free. A push that
+ * is still in progress can make pop return nothing even though the queue
+ * isn't empty; empty() tells the two cases apart, and the consumer has to
+ * retry until the push finishes.
+ */
+template<typename T>
+class MpscQueue {
+    // Most recently pushed node, swapped in by producers
+    std::atomic<QueueNode*> mHead;
+    // Oldest node, only touched by the consumer
+    QueueNode *mTail;
+    // Placeholder keeping the list non-empty
+    QueueNode mStub;
+
+    void pushNode(QueueNode *node)
+    {
+        node->mQueueNext.store(nullptr, std::memory_order_relaxed);
+        QueueNode *prev = mHead.exchange(node, std::memory_order_seq_cst);
+        prev->mQueueNext.store(node, std::memory_order_release);
+    }
+
+public:
+    MpscQueue() : mHead(&mStub), mTail(&mStub) { }
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+    ~MpscQueue()
+    {
+        UniquePtr<T> item;
+        while((item = pop()) != nullptr)
+            item = nullptr;
+    }
+
+    void push(UniquePtr<T> item) { pushNode(item.release()); }
+
+    /* Removes and returns the oldest item, or an empty pointer if there's none
+     * available yet.
+     */
+    UniquePtr<T> pop()
+    {
+        QueueNode *tail = mTail;
+        QueueNode *next = tail->mQueueNext.load(std::memory_order_acquire);
+        if(tail == &mStub)
+        {
+            if(!next) return nullptr;
+            mTail = next;
+            tail = next;
+            next = next->mQueueNext.load(std::memory_order_acquire);
+        }
+        if(!next)
+        {
+            // The tail is the last item. Leave it if a producer is still
+            // linking in a new one, otherwise put the stub behind it so it
+            // can be taken.
+            if(tail != mHead.load(std::memory_order_acquire))
+                return nullptr;
+            pushNode(&mStub);
+            next = tail->mQueueNext.load(std::memory_order_acquire);
+            if(!next) return nullptr;
+        }
+        mTail = next;
+        return UniquePtr<T>(static_cast<T*>(tail));
+    }
+
+    /* Returns true if nothing has been pushed that wasn't popped. Only
+     * meaningful from the consumer.
+     */
+    bool empty() const
+    { return mTail == &mStub && mHead.load(std::memory_order_seq_cst) == &mStub; }
+};
+
+} // namespace alure
+
+#endif /* MPSCQUEUE_H */
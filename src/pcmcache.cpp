@@ -0,0 +1,358 @@
+
+#include "config.h"
+
+#include "pcmcache.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "memstream.h"
+
+
+namespace alure
+{
+
+namespace {
+
+/* A cache file is this header, then the source's name, then the samples
+ * starting at mDataOffset. Everything's in the native byte order, which
+ * mByteOrder checks.
+ */
+struct PCMCacheHeader {
+    char mMagic[8];
+    uint32_t mByteOrder;
+    uint32_t mVersion;
+    uint64_t mSourceSize;
+    uint64_t mSourceHash;
+
+    uint32_t mFrequency;
+    uint32_t mChannels;
+    uint32_t mSampleType;
+    uint32_t mNameLength;
+    uint64_t mLength;
+    uint64_t mLoopStart;
+    uint64_t mLoopEnd;
+    uint64_t mDataOffset;
+};
+const char sCacheMagic[8] = {'A','L','U','R','E','P','C','M'};
+const uint32_t sCacheByteOrder = 0x01020304;
+const uint32_t sCacheVersion = 2;
+// Samples start aligned to this, so they can be used in place.
+const uint64_t sCacheDataAlign = 16;
+
+// FNV-1a over 64-bit words, then any remaining bytes.
+uint64_t HashBytes(uint64_t hash, const char *data, size_t size)
+{
+    const uint64_t prime = 0x100000001b3ull;
+    while(size >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        hash = (hash^word) * prime;
+        data += 8;
+        size -= 8;
+    }
+    while(size > 0)
+    {
+        hash = (hash^static_cast<ALubyte>(*(data++))) * prime;
+        --size;
+    }
+    return hash;
+}
+const uint64_t sHashBasis = 0xcbf29ce484222325ull;
+
+// Spreads the hash's bits, for use as a file name.
+uint64_t MixHash(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Gets a file's size and modification time, in seconds.
+bool GetFileStamp(const String &path, uint64_t &size, uint64_t &mtime)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if(_stat64(path.c_str(), &st) != 0)
+        return false;
+#else
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0)
+        return false;
+#endif
+    size = static_cast<uint64_t>(st.st_size);
+    mtime = static_cast<uint64_t>(st.st_mtime);
+    return true;
+}
+
+bool IsValidFormat(uint32_t chans, uint32_t type)
+{
+    return chans <= static_cast<uint32_t>(ChannelConfig::BFormat3D) &&
+           type <= static_cast<uint32_t>(SampleType::Mulaw);
+}
+
+
+class PCMCacheDecoder : public Decoder {
+    SharedPtr<FileMapping> mMapping;
+    const char *mSamples;
+
+    ALuint mFrequency;
+    ChannelConfig mChannelConfig;
+    SampleType mSampleType;
+    ALuint mFrameSize;
+    uint64_t mLength;
+    std::pair<uint64_t,uint64_t> mLoopPts;
+
+    uint64_t mPosition;
+
+public:
+    PCMCacheDecoder(SharedPtr<FileMapping> mapping, const PCMCacheHeader &header)
+      : mMapping(std::move(mapping)), mSamples(mMapping->data() + header.mDataOffset)
+      , mFrequency(header.mFrequency), mChannelConfig(static_cast<ChannelConfig>(header.mChannels))
+      , mSampleType(static_cast<SampleType>(header.mSampleType))
+      , mFrameSize(FramesToBytes(1, mChannelConfig, mSampleType)), mLength(header.mLength)
+      , mLoopPts{header.mLoopStart, header.mLoopEnd}, mPosition(0)
+    { }
+
+    ALuint getFrequency() const override final { return mFrequency; }
+    ChannelConfig getChannelConfig() const override final { return mChannelConfig; }
+    SampleType getSampleType() const override final { return mSampleType; }
+
+    uint64_t getLength() const override final { return mLength; }
+    uint64_t getPosition() const override final { return mPosition; }
+    bool seek(uint64_t pos) override final
+    {
+        if(pos > mLength) return false;
+        mPosition = pos;
+        return true;
+    }
+
+    std::pair<uint64_t,uint64_t> getLoopPoints() const override final { return mLoopPts; }
+
+    ALuint read(ALvoid *ptr, ALuint count) override final
+    {
+        count = static_cast<ALuint>(std::min<uint64_t>(count, mLength-mPosition));
+        memcpy(ptr, mSamples + mPosition*mFrameSize, size_t(count)*mFrameSize);
+        mPosition += count;
+        return count;
+    }
+};
+
+
+class PCMCacheWriter : public Decoder {
+    SharedPtr<Decoder> mDecoder;
+    PCMCacheEntry mEntry;
+
+    // Written to a temporary file first, which replaces the entry once done.
+    String mTempPath;
+    std::ofstream mFile;
+    uint64_t mDataOffset;
+    ALuint mFrameSize;
+    uint64_t mWritten;
+
+    static std::atomic<ALuint> sTempCount;
+
+    void finish()
+    {
+        std::pair<uint64_t,uint64_t> loop_pts = mDecoder->getLoopPoints();
+
+        PCMCacheHeader header;
+        memcpy(header.mMagic, sCacheMagic, sizeof(header.mMagic));
+        header.mByteOrder = sCacheByteOrder;
+        header.mVersion = sCacheVersion;
+        header.mSourceSize = mEntry.mSourceSize;
+        header.mSourceHash = mEntry.mSourceHash;
+        header.mFrequency = mDecoder->getFrequency();
+        header.mChannels = static_cast<uint32_t>(mDecoder->getChannelConfig());
+        header.mSampleType = static_cast<uint32_t>(mDecoder->getSampleType());
+        header.mNameLength = static_cast<uint32_t>(mEntry.mName.size());
+        header.mLength = mWritten;
+        header.mLoopStart = loop_pts.first;
+        header.mLoopEnd = loop_pts.second;
+        header.mDataOffset = mDataOffset;
+
+        mFile.seekp(0);
+        mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        mFile.close();
+        if(mFile.fail())
+        {
+            abandon();
+            return;
+        }
+
+        // Windows won't rename over an existing file.
+        std::remove(mEntry.mPath.c_str());
+        if(std::rename(mTempPath.c_str(), mEntry.mPath.c_str()) != 0)
+            std::remove(mTempPath.c_str());
+    }
+
+    void abandon()
+    {
+        if(mFile.is_open())
+            mFile.close();
+        std::remove(mTempPath.c_str());
+    }
+
+public:
+    PCMCacheWriter(SharedPtr<Decoder> decoder, PCMCacheEntry entry)
+      : mDecoder(std::move(decoder)), mEntry(std::move(entry)), mDataOffset(0), mFrameSize(0)
+      , mWritten(0)
+    {
+        mTempPath = mEntry.mPath + "." + std::to_string(sTempCount.fetch_add(1)) + ".tmp";
+
+        mDataOffset = sizeof(PCMCacheHeader) + mEntry.mName.size();
+        mDataOffset = (mDataOffset+sCacheDataAlign-1) / sCacheDataAlign * sCacheDataAlign;
+        mFrameSize = FramesToBytes(1, mDecoder->getChannelConfig(), mDecoder->getSampleType());
+
+        // Only cache from the start. The header is filled in when finished.
+        if(mDecoder->getPosition() != 0)
+            return;
+        mFile.open(mTempPath.c_str(), std::ios::binary | std::ios::trunc);
+        if(!mFile.is_open())
+            return;
+        Vector<char> prefix(mDataOffset, 0);
+        memcpy(&prefix[sizeof(PCMCacheHeader)], mEntry.mName.data(), mEntry.mName.size());
+        mFile.write(prefix.data(), prefix.size());
+        if(mFile.fail())
+            abandon();
+    }
+    ~PCMCacheWriter() override final
+    {
+        if(mFile.is_open())
+            abandon();
+    }
+
+    ALuint getFrequency() const override final { return mDecoder->getFrequency(); }
+    ChannelConfig getChannelConfig() const override final { return mDecoder->getChannelConfig(); }
+    SampleType getSampleType() const override final { return mDecoder->getSampleType(); }
+
+    uint64_t getLength() const override final { return mDecoder->getLength(); }
+    uint64_t getPosition() const override final { return mDecoder->getPosition(); }
+    bool seek(uint64_t pos) override final
+    {
+        if(mFile.is_open() && pos != mWritten)
+            abandon();
+        return mDecoder->seek(pos);
+    }
+
+    std::pair<uint64_t,uint64_t> getLoopPoints() const override final
+    { return mDecoder->getLoopPoints(); }
+
+    ALuint read(ALvoid *ptr, ALuint count) override final
+    {
+        ALuint got = mDecoder->read(ptr, count);
+        if(!mFile.is_open())
+            return got;
+
+        mFile.write(static_cast<const char*>(ptr), size_t(got)*mFrameSize);
+        mWritten += got;
+        if(mFile.fail())
+            abandon();
+        // Done at the end of the stream, or once a buffer's worth of samples
+        // has been read.
+        else if(got < count || (mDecoder->getLength() > 0 && mWritten >= mDecoder->getLength()))
+        {
+            if(mWritten > 0)
+                finish();
+            else
+                abandon();
+        }
+        return got;
+    }
+};
+std::atomic<ALuint> PCMCacheWriter::sTempCount{0};
+
+} // namespace
+
+
+PCMCacheEntry::PCMCacheEntry(const String &dir, const String &name, std::istream &file, SampleType preferred)
+  : mName(name), mSourceSize(0), mSourceHash(sHashBasis)
+{
+    uint64_t mtime;
+    const String *filepath = GetFilePath(file);
+    if(filepath && GetFileStamp(*filepath, mSourceSize, mtime))
+        mSourceHash = HashBytes(mSourceHash, reinterpret_cast<const char*>(&mtime), sizeof(mtime));
+    else if(MemoryStreamBuf *membuf = MemoryStream::GetBuffer(file))
+    {
+        mSourceSize = membuf->size();
+        mSourceHash = HashBytes(mSourceHash, membuf->data(), membuf->size());
+    }
+    else
+    {
+        // A decoder is already reading the stream, so put it back where it
+        // was.
+        file.clear();
+        std::istream::pos_type pos = file.tellg();
+        if(pos == std::istream::pos_type(-1) || !file.seekg(0))
+            throw std::runtime_error("Failed to rewind "+name+" for hashing");
+
+        Vector<char> chunk(65536);
+        while(file.read(chunk.data(), chunk.size()) || file.gcount() > 0)
+        {
+            size_t got = static_cast<size_t>(file.gcount());
+            mSourceSize += got;
+            mSourceHash = HashBytes(mSourceHash, chunk.data(), got);
+        }
+        if(!(file.clear(),file.seekg(pos)))
+            throw std::runtime_error("Failed to restore "+name+" after hashing");
+    }
+
+    char type = static_cast<char>(preferred);
+    uint64_t key = HashBytes(HashBytes(sHashBasis, name.data(), name.size()), &type, 1);
+    char fname[32];
+    snprintf(fname, sizeof(fname), "%016llx.pcm", (unsigned long long)MixHash(key));
+
+    mPath = dir;
+    if(!mPath.empty() && mPath.back() != '/' && mPath.back() != '\\')
+        mPath += '/';
+    mPath += fname;
+}
+
+
+SharedPtr<Decoder> OpenPCMCache(const PCMCacheEntry &entry)
+{
+    SharedPtr<FileMapping> mapping = FileMapping::Open(entry.mPath);
+    if(!mapping || mapping->size() < sizeof(PCMCacheHeader))
+        return nullptr;
+
+    PCMCacheHeader header;
+    memcpy(&header, mapping->data(), sizeof(header));
+    if(memcmp(header.mMagic, sCacheMagic, sizeof(header.mMagic)) != 0 ||
+       header.mByteOrder != sCacheByteOrder || header.mVersion != sCacheVersion ||
+       header.mSourceSize != entry.mSourceSize || header.mSourceHash != entry.mSourceHash ||
+       !IsValidFormat(header.mChannels, header.mSampleType) || header.mFrequency == 0)
+        return nullptr;
+
+    // Another name could share the file name's hash.
+    if(header.mNameLength != entry.mName.size() ||
+       mapping->size()-sizeof(header) < header.mNameLength ||
+       memcmp(mapping->data()+sizeof(header), entry.mName.data(), header.mNameLength) != 0)
+        return nullptr;
+
+    uint64_t framesize = FramesToBytes(1, static_cast<ChannelConfig>(header.mChannels),
+                                       static_cast<SampleType>(header.mSampleType));
+    if(header.mDataOffset > mapping->size() ||
+       header.mLength > (mapping->size()-header.mDataOffset) / framesize)
+        return nullptr;
+
+    return MakeShared<PCMCacheDecoder>(std::move(mapping), header);
+}
+
+
+SharedPtr<Decoder> MakePCMCacheWriter(SharedPtr<Decoder> decoder, PCMCacheEntry entry)
+{
+    return MakeShared<PCMCacheWriter>(std::move(decoder), std::move(entry));
+}
+
+} // namespace alure
@@ -0,0 +1,43 @@
+#ifndef PCMCACHE_H
+#define PCMCACHE_H
+
+#include "main.h"
+
+#include <istream>
+
+namespace alure {
+
+/* Where a source's decoded samples are cached, and what the source was when
+ * they were, to tell if the cached copy is still good.
+ */
+struct PCMCacheEntry {
+    String mPath;
+    String mName;
+    uint64_t mSourceSize;
+    // A hash of the source's contents, or of its modification time if it's a
+    // plain file.
+    uint64_t mSourceHash;
+
+    /* Identifies the named source in the given cache directory from its file.
+     * Plain files are identified by their size and modification time, and
+     * other streams by hashing their contents, leaving the read position as
+     * it was. The decoders' preferred sample type is part of the key, as it
+     * can change what they decode to.
+     */
+    PCMCacheEntry(const String &dir, const String &name, std::istream &file, SampleType preferred);
+};
+
+/* Returns a decoder for the entry's cached samples, or nullptr if they're
+ * missing or out of date.
+ */
+SharedPtr<Decoder> OpenPCMCache(const PCMCacheEntry &entry);
+
+/* Wraps a decoder so the samples read from it are written to the cache. The
+ * entry is only written once the whole source has been read in order from the
+ * start, and is dropped if it's seeked elsewhere first.
+ */
+SharedPtr<Decoder> MakePCMCacheWriter(SharedPtr<Decoder> decoder, PCMCacheEntry entry);
+
+} // namespace alure
+
+#endif /* PCMCACHE_H */
@@ -0,0 +1,322 @@
+
+#include "config.h"
+
+#include "soundbank.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <map>
+
+#include "memstream.h"
+
+
+namespace alure
+{
+
+namespace {
+
+/* A bank is this header, then each file's data aligned to sBankDataAlign,
+ * then the index at mIndexOffset: mCount entries sorted by name, followed by
+ * the string table they refer to. Everything's in the native byte order,
+ * which mByteOrder checks.
+ */
+struct BankHeader {
+    char mMagic[8];
+    uint32_t mByteOrder;
+    uint32_t mVersion;
+    uint32_t mCount;
+    uint32_t mStringsSize;
+    uint64_t mIndexOffset;
+};
+
+struct BankEntry {
+    uint64_t mOffset;
+    uint64_t mSize;
+    uint32_t mNameOffset;
+    uint32_t mNameLength;
+    // The decoder factory that opened the file when it was packed.
+    uint32_t mDecoderOffset;
+    uint32_t mDecoderLength;
+
+    uint32_t mFrequency;
+    uint32_t mChannels;
+    uint32_t mSampleType;
+    uint32_t mPadding;
+    uint64_t mLength;
+};
+
+const char sBankMagic[8] = {'A','L','U','R','E','B','N','K'};
+const uint32_t sBankByteOrder = 0x01020304;
+const uint32_t sBankVersion = 1;
+const uint64_t sBankDataAlign = 16;
+
+// Orders names the same as String::compare.
+int CompareName(const char *lhs, size_t lhslen, const char *rhs, size_t rhslen)
+{
+    int cmp = memcmp(lhs, rhs, std::min(lhslen, rhslen));
+    if(cmp != 0) return cmp;
+    return (lhslen < rhslen) ? -1 : (lhslen > rhslen) ? 1 : 0;
+}
+
+int GetHintIndex()
+{
+    static const int index = std::ios_base::xalloc();
+    return index;
+}
+
+// A file in a bank, which also carries its decoder's name.
+class BankStream : public MemoryStream {
+    String mDecoder;
+
+public:
+    BankStream(const char *data, size_t size, SharedPtr<FileMapping> mapping, String decoder)
+      : MemoryStream(data, size, std::move(mapping)), mDecoder(std::move(decoder))
+    { pword(GetHintIndex()) = &mDecoder; }
+};
+
+
+/* A memory-mapped bank. The index is checked when it's opened, then used in
+ * place, so finding a file is a binary search and opening it only makes a
+ * stream over its part of the mapping.
+ */
+class SoundBank {
+    SharedPtr<FileMapping> mMapping;
+    const BankEntry *mEntries;
+    uint32_t mCount;
+    const char *mStrings;
+
+    const char *getName(const BankEntry &entry) const { return mStrings + entry.mNameOffset; }
+
+public:
+    SoundBank(const String &filename);
+
+    const BankEntry *find(const String &name) const;
+    UniquePtr<std::istream> open(const BankEntry &entry) const;
+};
+
+SoundBank::SoundBank(const String &filename)
+  : mEntries(nullptr), mCount(0), mStrings(nullptr)
+{
+    mMapping = FileMapping::Open(filename);
+    if(!mMapping)
+        throw std::runtime_error("Failed to open sound bank "+filename);
+
+    const uint64_t size = mMapping->size();
+    BankHeader header;
+    if(size < sizeof(header))
+        throw std::runtime_error("Invalid sound bank "+filename);
+    memcpy(&header, mMapping->data(), sizeof(header));
+    if(memcmp(header.mMagic, sBankMagic, sizeof(header.mMagic)) != 0 ||
+       header.mByteOrder != sBankByteOrder)
+        throw std::runtime_error("Invalid sound bank "+filename);
+    if(header.mVersion != sBankVersion)
+        throw std::runtime_error("Unsupported sound bank version in "+filename);
+
+    if(header.mIndexOffset > size || header.mIndexOffset%alignof(BankEntry) != 0 ||
+       header.mCount > (size-header.mIndexOffset) / sizeof(BankEntry) ||
+       header.mStringsSize > size-header.mIndexOffset - uint64_t(header.mCount)*sizeof(BankEntry))
+        throw std::runtime_error("Invalid sound bank index in "+filename);
+
+    mEntries = reinterpret_cast<const BankEntry*>(mMapping->data() + header.mIndexOffset);
+    mCount = header.mCount;
+    mStrings = reinterpret_cast<const char*>(mEntries + mCount);
+
+    for(uint32_t i = 0;i < mCount;++i)
+    {
+        const BankEntry &entry = mEntries[i];
+        if(entry.mOffset > size || entry.mSize > size-entry.mOffset ||
+           entry.mNameOffset > header.mStringsSize ||
+           entry.mNameLength > header.mStringsSize-entry.mNameOffset ||
+           entry.mDecoderOffset > header.mStringsSize ||
+           entry.mDecoderLength > header.mStringsSize-entry.mDecoderOffset)
+            throw std::runtime_error("Invalid sound bank entry in "+filename);
+        // Lookups rely on the names being sorted.
+        if(i > 0 && CompareName(getName(mEntries[i-1]), mEntries[i-1].mNameLength,
+                                getName(entry), entry.mNameLength) >= 0)
+            throw std::runtime_error("Unsorted sound bank index in "+filename);
+    }
+}
+
+const BankEntry *SoundBank::find(const String &name) const
+{
+    const BankEntry *entry = std::lower_bound(mEntries, mEntries+mCount, name,
+        [this](const BankEntry &lhs, const String &rhs) -> bool
+        { return CompareName(getName(lhs), lhs.mNameLength, rhs.data(), rhs.size()) < 0; }
+    );
+    if(entry == mEntries+mCount ||
+       CompareName(getName(*entry), entry->mNameLength, name.data(), name.size()) != 0)
+        return nullptr;
+    return entry;
+}
+
+UniquePtr<std::istream> SoundBank::open(const BankEntry &entry) const
+{
+    return MakeUnique<BankStream>(mMapping->data() + entry.mOffset, entry.mSize, mMapping,
+        String(mStrings + entry.mDecoderOffset, entry.mDecoderLength)
+    );
+}
+
+
+class SoundBankFileIOFactory : public FileIOFactory {
+    Vector<UniquePtr<SoundBank>> mBanks;
+    UniquePtr<FileIOFactory> mFallback;
+
+public:
+    SoundBankFileIOFactory(const Vector<String> &banks, UniquePtr<FileIOFactory> fallback)
+      : mFallback(std::move(fallback))
+    {
+        mBanks.reserve(banks.size());
+        for(const String &bank : banks)
+            mBanks.emplace_back(MakeUnique<SoundBank>(bank));
+    }
+
+    UniquePtr<std::istream> openFile(const String &name) override final
+    {
+        for(const auto &bank : mBanks)
+        {
+            if(const BankEntry *entry = bank->find(name))
+                return bank->open(*entry);
+        }
+        if(mFallback) return mFallback->openFile(name);
+        return OpenMappedFile(name);
+    }
+};
+
+} // namespace
+
+
+const String *GetDecoderHint(std::istream &stream)
+{
+    return static_cast<const String*>(stream.pword(GetHintIndex()));
+}
+
+
+void WriteSoundBank(const String &filename, const Vector<String> &names)
+{
+    {
+        Vector<String> sorted(names);
+        std::sort(sorted.begin(), sorted.end());
+        auto dup = std::adjacent_find(sorted.begin(), sorted.end());
+        if(dup != sorted.end())
+            throw std::runtime_error("Duplicate sound bank name "+*dup);
+    }
+
+    std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+    if(!out.is_open())
+        throw std::runtime_error("Failed to create sound bank "+filename);
+
+    // The header is written last, once the index is placed.
+    BankHeader header;
+    memset(&header, 0, sizeof(header));
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t offset = sizeof(header);
+
+    struct PackedFile {
+        String mName;
+        String mDecoder;
+        BankEntry mEntry;
+    };
+    Vector<PackedFile> entries;
+    std::map<String,uint32_t> decoders;
+    entries.reserve(names.size());
+    Vector<char> data;
+    const char padding[sBankDataAlign]{};
+    for(const String &name : names)
+    {
+        auto file = FileIOFactory::get().openFile(name);
+        if(!file) throw std::runtime_error("Failed to open "+name);
+
+        const char *src;
+        size_t srclen;
+        if(MemoryStreamBuf *membuf = MemoryStream::GetBuffer(*file))
+        {
+            src = membuf->data();
+            srclen = membuf->size();
+        }
+        else
+        {
+            data.clear();
+            char chunk[65536];
+            while(file->read(chunk, sizeof(chunk)) || file->gcount() > 0)
+                data.insert(data.end(), chunk, chunk+file->gcount());
+            src = data.data();
+            srclen = data.size();
+        }
+
+        // Find the decoder now, so it needn't be probed for when loading.
+        String factoryname;
+        auto decoder = GetDecoder(name, MakeUnique<MemoryStream>(src, srclen), factoryname);
+
+        BankEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.mSize = srclen;
+        entry.mNameLength = static_cast<uint32_t>(name.size());
+        entry.mDecoderLength = static_cast<uint32_t>(factoryname.size());
+        entry.mFrequency = decoder->getFrequency();
+        entry.mChannels = static_cast<uint32_t>(decoder->getChannelConfig());
+        entry.mSampleType = static_cast<uint32_t>(decoder->getSampleType());
+        entry.mLength = decoder->getLength();
+        decoder = nullptr;
+
+        uint64_t pad = (sBankDataAlign - offset%sBankDataAlign) % sBankDataAlign;
+        out.write(padding, pad);
+        entry.mOffset = offset + pad;
+        out.write(src, srclen);
+        offset = entry.mOffset + srclen;
+
+        decoders.insert(std::make_pair(factoryname, 0));
+        entries.push_back(PackedFile{name, std::move(factoryname), entry});
+    }
+
+    std::sort(entries.begin(), entries.end(),
+        [](const PackedFile &lhs, const PackedFile &rhs) -> bool
+        { return lhs.mName < rhs.mName; }
+    );
+
+    // Names go in the string table in index order, followed by each decoder
+    // name once.
+    String strings;
+    for(PackedFile &file : entries)
+    {
+        file.mEntry.mNameOffset = static_cast<uint32_t>(strings.size());
+        strings += file.mName;
+    }
+    for(auto &decoder : decoders)
+    {
+        decoder.second = static_cast<uint32_t>(strings.size());
+        strings += decoder.first;
+    }
+
+    uint64_t pad = (alignof(BankEntry) - offset%alignof(BankEntry)) % alignof(BankEntry);
+    out.write(padding, pad);
+    offset += pad;
+    for(PackedFile &file : entries)
+    {
+        file.mEntry.mDecoderOffset = decoders[file.mDecoder];
+        out.write(reinterpret_cast<const char*>(&file.mEntry), sizeof(file.mEntry));
+    }
+    out.write(strings.data(), strings.size());
+
+    memcpy(header.mMagic, sBankMagic, sizeof(header.mMagic));
+    header.mByteOrder = sBankByteOrder;
+    header.mVersion = sBankVersion;
+    header.mCount = static_cast<uint32_t>(entries.size());
+    header.mStringsSize = static_cast<uint32_t>(strings.size());
+    header.mIndexOffset = offset;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    out.close();
+    if(out.fail())
+        throw std::runtime_error("Failed to write sound bank "+filename);
+}
+
+
+UniquePtr<FileIOFactory> MakeSoundBankFactory(const Vector<String> &banks, UniquePtr<FileIOFactory> fallback)
+{
+    return MakeUnique<SoundBankFileIOFactory>(banks, std::move(fallback));
+}
+
+} // namespace alure
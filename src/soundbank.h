@@ -0,0 +1,17 @@
+#ifndef SOUNDBANK_H
+#define SOUNDBANK_H
+
+#include "main.h"
+
+#include <istream>
+
+namespace alure {
+
+/* Returns the name of the decoder factory a sound bank recorded for the file
+ * opened from it, or nullptr if the stream isn't from a sound bank.
+ */
+const String *GetDecoderHint(std::istream &stream);
+
+} // namespace alure
+
+#endif /* SOUNDBANK_H */
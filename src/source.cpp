@@ -6,9 +6,11 @@
 #include <cstring>
 
 #include <stdexcept>
+#include <algorithm>
 #include <sstream>
 #include <memory>
 #include <limits>
+#include <deque>
 
 #include "al.h"
 #include "alext.h"
@@ -17,38 +19,113 @@
 #include "buffer.h"
 #include "auxeffectslot.h"
 #include "sourcegroup.h"
+#include "streamdecoder.h"
+#include "trace.h"
 
 namespace alure
 {
 
 class ALBufferStream {
-    SharedPtr<Decoder> mDecoder;
+    ALContext *const mContext;
+    SharedPtr<Decoder> mSource;
+    SharedPtr<StreamDecoder> mDecoder;
 
+    // Current sizes, and the bounds they may be adapted within. The bounds
+    // are equal for fixed-size streams.
     ALuint mUpdateLen;
     ALuint mNumUpdates;
+    ALuint mMinUpdateLen, mMaxUpdateLen;
+    ALuint mMinUpdates, mMaxUpdates;
+
+    // Set when the decoder's ring needs to change size. Decoding ahead stops
+    // until the decoded blocks are used up, then the ring is replaced.
+    bool mResizePending;
+    // Frames queued since the last underrun or size change
+    uint64_t mStableFrames;
 
     ALenum mFormat;
     ALuint mFrequency;
     ALuint mFrameSize;
 
-    Vector<ALbyte> mData;
-    ALbyte mSilence;
-
     Vector<ALuint> mBufferIds;
-    ALuint mCurrentIdx;
+    Vector<ALuint> mFreeBuffers;
+    // Lengths of the buffers queued on the source, oldest first
+    std::deque<ALuint> mQueuedLens;
+    uint64_t mQueuedFrames;
 
+    // State as of the last queued block
+    uint64_t mPosition;
     std::pair<uint64_t,uint64_t> mLoopPts;
-    std::atomic<bool> mHasLooped;
-    std::atomic<bool> mDone;
+    bool mHasLooped;
+
+    void genBuffers(ALuint count)
+    {
+        if(count == 0) return;
+        size_t oldsize = mBufferIds.size();
+        mBufferIds.resize(oldsize+count);
+        alGenBuffers(count, &mBufferIds[oldsize]);
+        mFreeBuffers.insert(mFreeBuffers.end(), mBufferIds.begin()+oldsize, mBufferIds.end());
+    }
+
+    void setSize(ALuint updatelen, ALuint numupdates)
+    {
+        if(numupdates > mBufferIds.size())
+            genBuffers(numupdates - mBufferIds.size());
+        mUpdateLen = updatelen;
+        mNumUpdates = numupdates;
+        mResizePending = true;
+        mStableFrames = 0;
+    }
+
+    // Adjusts the sizes of an adaptive stream. The queue shrinks after a
+    // stretch of glitch-free playback, and grows early if decoding takes a
+    // large part of each update's play time.
+    void adapt()
+    {
+        if(mMinUpdateLen == mMaxUpdateLen && mMinUpdates == mMaxUpdates)
+            return;
+
+        uint64_t playtime = uint64_t(mUpdateLen) * 1000000000 / mFrequency;
+        uint64_t decodetime = mDecoder->getDecodeTime();
+        if(decodetime*2 > playtime)
+        {
+            if(mStableFrames >= uint64_t(mUpdateLen)*mNumUpdates)
+                grow();
+        }
+        else if(decodetime*4 < playtime && mStableFrames >= uint64_t(mFrequency)*10)
+        {
+            if(mUpdateLen > mMinUpdateLen)
+                setSize(std::max(mUpdateLen/2, mMinUpdateLen), mNumUpdates);
+            else if(mNumUpdates > mMinUpdates)
+                setSize(mUpdateLen, mNumUpdates-1);
+            else
+                mStableFrames = 0;
+        }
+    }
+
+    void grow()
+    {
+        if(mNumUpdates < mMaxUpdates)
+            setSize(mUpdateLen, std::min(mNumUpdates*2, mMaxUpdates));
+        else if(mUpdateLen < mMaxUpdateLen)
+            setSize(std::min(mUpdateLen*2, mMaxUpdateLen), mNumUpdates);
+        else
+            mStableFrames = 0;
+    }
 
 public:
-    ALBufferStream(SharedPtr<Decoder> decoder, ALuint updatelen, ALuint numupdates)
-      : mDecoder(decoder), mUpdateLen(updatelen), mNumUpdates(numupdates),
-        mFormat(AL_NONE), mFrequency(0), mFrameSize(0), mSilence(0),
-        mCurrentIdx(0), mLoopPts{0,0}, mHasLooped(false), mDone(false)
+    ALBufferStream(ALContext *context, SharedPtr<Decoder> decoder, ALuint minupdatelen, ALuint maxupdatelen,
+                   ALuint minupdates, ALuint maxupdates)
+      : mContext(context), mSource(decoder), mUpdateLen(minupdatelen), mNumUpdates(minupdates),
+        mMinUpdateLen(minupdatelen), mMaxUpdateLen(maxupdatelen), mMinUpdates(minupdates),
+        mMaxUpdates(maxupdates), mResizePending(false), mStableFrames(0), mFormat(AL_NONE),
+        mFrequency(0), mFrameSize(0), mQueuedFrames(0), mPosition(0), mLoopPts{0,0},
+        mHasLooped(false)
     { }
     ~ALBufferStream()
     {
+        if(mDecoder)
+            mDecoder->cancel();
         if(!mBufferIds.empty())
         {
             alDeleteBuffers(mBufferIds.size(), &mBufferIds[0]);
@@ -57,27 +134,47 @@ public:
     }
 
     uint64_t getLength() const { return mDecoder->getLength(); }
-    uint64_t getPosition() const { return mDecoder->getPosition(); }
+    uint64_t getPosition() const { return mPosition; }
 
     ALuint getNumUpdates() const { return mNumUpdates; }
-    ALuint getUpdateLength() const { return mUpdateLen; }
+    // Total sample frames in the buffers queued on the source
+    uint64_t getQueuedFrames() const { return mQueuedFrames; }
+
+    // Time until the oldest queued buffer finishes playing, given the source's
+    // sample offset into it and its effective pitch.
+    std::chrono::nanoseconds getFrontRemaining(ALint srcpos, ALfloat pitch) const
+    {
+        if(mQueuedLens.empty() || srcpos >= (ALint)mQueuedLens.front())
+            return std::chrono::nanoseconds::zero();
+        ALuint left = mQueuedLens.front() - std::max(srcpos, 0);
+        return std::chrono::nanoseconds(
+            static_cast<int64_t>(left * 1000000000.0 / (mFrequency*pitch))
+        );
+    }
 
+    void setLooping(bool looping) { mDecoder->setLooping(looping); }
+
+    // Seeks and synchronously decodes enough to fill the source's queue, so
+    // playback can start right away.
     bool seek(uint64_t pos)
     {
         if(!mDecoder->seek(pos))
             return false;
-        mHasLooped.store(false, std::memory_order_release);
-        mDone.store(false, std::memory_order_release);
+        mPosition = pos;
+        mHasLooped = false;
+        if(mResizePending && mDecoder->resize(mUpdateLen, mNumUpdates))
+            mResizePending = false;
+        mDecoder->decode(mNumUpdates);
         return true;
     }
 
     void prepare()
     {
-        ALuint srate = mDecoder->getFrequency();
-        ChannelConfig chans = mDecoder->getChannelConfig();
-        SampleType type = mDecoder->getSampleType();
+        ALuint srate = mSource->getFrequency();
+        ChannelConfig chans = mSource->getChannelConfig();
+        SampleType type = mSource->getSampleType();
 
-        mLoopPts = mDecoder->getLoopPoints();
+        mLoopPts = mSource->getLoopPoints();
         if(mLoopPts.first >= mLoopPts.second)
         {
             mLoopPts.first = 0;
@@ -94,76 +191,112 @@ public:
             throw std::runtime_error(sstr.str());
         }
 
-        mData.resize(mUpdateLen * mFrameSize);
-        if(type == SampleType::UInt8) mSilence = 0x80;
-        else if(type == SampleType::Mulaw) mSilence = 0x7f;
-        else mSilence = 0x00;
+        ALbyte silence = 0;
+        if(type == SampleType::UInt8) silence = 0x80;
+        else if(type == SampleType::Mulaw) silence = 0x7f;
+
+        mDecoder = MakeShared<StreamDecoder>(std::move(mSource), mUpdateLen, mNumUpdates,
+                                             mFrameSize, silence, mLoopPts);
 
-        mBufferIds.assign(mNumUpdates, 0);
-        alGenBuffers(mBufferIds.size(), &mBufferIds[0]);
+        genBuffers(mNumUpdates);
     }
 
     uint64_t getLoopStart() const { return mLoopPts.first; }
     uint64_t getLoopEnd() const { return mLoopPts.second; }
 
-    bool hasLooped() const { return mHasLooped.load(std::memory_order_acquire); }
-    bool hasMoreData() const { return !mDone.load(std::memory_order_acquire); }
-    bool streamMoreData(ALuint srcid, bool loop)
+    bool hasLooped() const { return mHasLooped; }
+    bool hasMoreData() const { return mDecoder->hasMoreData(); }
+
+    // Queues the next decoded block on the source, if one is ready. This only
+    // copies already-decoded data into OpenAL.
+    bool streamMoreData(ALuint srcid)
     {
-        if(mDone.load(std::memory_order_acquire))
+        ALURE_TRACE_ZONE("ALBufferStream::streamMoreData");
+        StreamDecoder::BlockHeader header;
+        const ALbyte *data;
+        if(mFreeBuffers.empty() || !mDecoder->front(header, data))
             return false;
 
-        ALuint frames;
-        if(!loop)
-            frames = mDecoder->read(&mData[0], mUpdateLen);
-        else
-        {
-            ALuint len = mUpdateLen;
-            uint64_t pos = mDecoder->getPosition();
-            if(pos <= mLoopPts.second)
-                len = std::min<uint64_t>(len, mLoopPts.second - pos);
-            else
-                loop = false;
+        ALuint bufid = mFreeBuffers.back();
+        ALuint len = mDecoder->getUpdateLength();
+        alBufferData(bufid, mFormat, data, len*mFrameSize, mFrequency);
+        alSourceQueueBuffers(srcid, 1, &bufid);
+        mFreeBuffers.pop_back();
+        mQueuedLens.push_back(len);
+        mQueuedFrames += len;
+        mStableFrames += header.mFrames;
+
+        mPosition = header.mPosition;
+        mLoopPts = std::make_pair(header.mLoopStart, header.mLoopEnd);
+        mHasLooped = header.mHasLooped;
+        mDecoder->pop();
+        return true;
+    }
 
-            frames = mDecoder->read(&mData[0], len);
-            if(frames < mUpdateLen && loop && pos+frames > 0)
-            {
-                if(pos+frames < mLoopPts.second)
-                {
-                    mLoopPts.second = pos+frames;
-                    mLoopPts.first = std::min(mLoopPts.first, mLoopPts.second-1);
-                }
+    // Takes back a buffer the source finished with. Buffers beyond the
+    // current queue size are deleted.
+    void bufferProcessed(ALuint bufid)
+    {
+        if(!mQueuedLens.empty())
+        {
+            mQueuedFrames -= mQueuedLens.front();
+            mQueuedLens.pop_front();
+        }
 
-                do {
-                    if(!mDecoder->seek(mLoopPts.first))
-                        break;
-                    mHasLooped.store(true, std::memory_order_release);
+        if(mBufferIds.size() <= mNumUpdates)
+            mFreeBuffers.push_back(bufid);
+        else
+        {
+            alDeleteBuffers(1, &bufid);
+            mBufferIds.erase(std::find(mBufferIds.begin(), mBufferIds.end(), bufid));
+        }
+    }
 
-                    len = std::min<uint64_t>(mUpdateLen-frames, mLoopPts.second-mLoopPts.first);
-                    ALuint got = mDecoder->read(&mData[frames*mFrameSize], len);
-                    if(got == 0) break;
-                    frames += got;
-                } while(frames < mUpdateLen);
-            }
+    // Called after the source's queue was cleared without unqueueing.
+    void resetQueue()
+    {
+        mQueuedLens.clear();
+        mQueuedFrames = 0;
+        mFreeBuffers = mBufferIds;
+        while(mFreeBuffers.size() > mNumUpdates)
+        {
+            alDeleteBuffers(1, &mFreeBuffers.back());
+            mBufferIds.erase(std::find(mBufferIds.begin(), mBufferIds.end(), mFreeBuffers.back()));
+            mFreeBuffers.pop_back();
         }
-        if(frames < mUpdateLen)
+    }
+
+    // Called when the source was found to have run out of queued data.
+    void underrun()
+    {
+        // Only count it once per recovery.
+        if(mStableFrames > 0)
         {
-            mDone.store(true, std::memory_order_release);
-            if(frames == 0) return false;
-            std::fill(mData.begin() + frames*mFrameSize, mData.end(), mSilence);
+            mContext->countUnderrun();
+            grow();
         }
+    }
 
-        alBufferData(mBufferIds[mCurrentIdx], mFormat, &mData[0], mData.size(), mFrequency);
-        alSourceQueueBuffers(srcid, 1, &mBufferIds[mCurrentIdx]);
-        mCurrentIdx = (mCurrentIdx+1) % mBufferIds.size();
-        return true;
+    // Hands the stream to a decode thread if it has room to decode ahead.
+    void scheduleDecode()
+    {
+        adapt();
+        if(mResizePending)
+        {
+            if(!mDecoder->resize(mUpdateLen, mNumUpdates))
+                return;
+            mResizePending = false;
+        }
+        if(mDecoder->needsDecode() && mDecoder->markQueued())
+            mContext->addStreamDecode(mDecoder);
     }
 };
 
 
 ALSource::ALSource(ALContext *context)
   : mContext(context), mId(0), mBuffer(0), mGroup(nullptr), mIsAsync(false),
-    mDirectFilter(AL_FILTER_NULL)
+    mStreamPitch(1.0f), mDirectFilter(AL_FILTER_NULL), mVirtual(false), mClockOffset(0), mVoiceGain(0.0f),
+    mVoiceScore(0.0f), mVoiceIndex(std::numeric_limits<size_t>::max())
 {
     resetProperties();
 }
@@ -183,6 +316,7 @@ void ALSource::resetProperties()
     mLooping = false;
     mOffset = 0;
     mPitch = 1.0f;
+    mStreamPitch.store(1.0f, std::memory_order_relaxed);
     mGain = 1.0f;
     mMinGain = 0.0f;
     mMaxGain = 1.0f;
@@ -221,56 +355,202 @@ void ALSource::resetProperties()
     mEffectSlots.clear();
 
     mPriority = 0;
+    mDirty = 0;
+    setVirtual(false);
 }
 
-void ALSource::applyProperties(bool looping, ALuint offset) const
+void ALSource::markDirty(ALuint flags)
 {
-    alSourcei(mId, AL_LOOPING, looping ? AL_TRUE : AL_FALSE);
-    alSourcei(mId, AL_SAMPLE_OFFSET, offset);
-    if(mGroup)
+    if(mId == 0) return;
+    if(!mDirty) mContext->addDirtySource(this);
+    mDirty |= flags;
+}
+
+ALuint ALSource::getNonDefaultProps() const
+{
+    // The properties that differ from what a newly generated source has.
+    ALuint props = 0;
+    if(mPitch != 1.0f || (mGroup && mGroup->getAppliedPitch() != 1.0f))
+        props |= DirtyPitch;
+    if(mGain != 1.0f || (mGroup && mGroup->getAppliedGain() != 1.0f))
+        props |= DirtyGain;
+    if(mMinGain != 0.0f || mMaxGain != 1.0f)
+        props |= DirtyGainRange;
+    if(mRefDist != 1.0f || mMaxDist != std::numeric_limits<float>::max())
+        props |= DirtyDistanceRange;
+    if(mPosition != Vector3(0.0f))
+        props |= DirtyPosition;
+    if(mVelocity != Vector3(0.0f))
+        props |= DirtyVelocity;
+    if(mDirection != Vector3(0.0f))
+        props |= DirtyDirection;
+    if(mOrientation[0] != Vector3(0.0f, 0.0f, -1.0f) || mOrientation[1] != Vector3(0.0f, 1.0f, 0.0f))
+        props |= DirtyOrientation;
+    if(mConeInnerAngle != 360.0f || mConeOuterAngle != 360.0f)
+        props |= DirtyConeAngles;
+    if(mConeOuterGain != 0.0f || mConeOuterGainHF != 1.0f)
+        props |= DirtyConeGains;
+    if(mRolloffFactor != 1.0f || mRoomRolloffFactor != 0.0f)
+        props |= DirtyRolloff;
+    if(mDopplerFactor != 1.0f)
+        props |= DirtyDoppler;
+    if(mAirAbsorptionFactor != 0.0f)
+        props |= DirtyAirAbsorption;
+    if(mRadius != 0.0f)
+        props |= DirtyRadius;
+    if(mStereoAngles[0] != F_PI/6.0f || mStereoAngles[1] != -F_PI/6.0f)
+        props |= DirtyStereoAngles;
+    if(mRelative)
+        props |= DirtyRelative;
+    if(!mDryGainHFAuto || !mWetGainAuto || !mWetGainHFAuto)
+        props |= DirtyGainAuto;
+    return props;
+}
+
+void ALSource::applyProperties(bool looping, ALuint offset, bool fresh)
+{
+    // A newly generated source already has the default properties, so only
+    // what differs needs setting. A reused one may have anything.
+    ALuint calls = 0;
+    if(!fresh || looping)
     {
-        alSourcef(mId, AL_PITCH, mPitch * mGroup->getAppliedPitch());
-        alSourcef(mId, AL_GAIN, mGain * mGroup->getAppliedGain());
+        alSourcei(mId, AL_LOOPING, looping ? AL_TRUE : AL_FALSE);
+        calls += 1;
     }
-    else
+    if(!fresh || offset != 0)
     {
-        alSourcef(mId, AL_PITCH, mPitch);
-        alSourcef(mId, AL_GAIN, mGain);
-    }
-    alSourcef(mId, AL_MIN_GAIN, mMinGain);
-    alSourcef(mId, AL_MAX_GAIN, mMaxGain);
-    alSourcef(mId, AL_REFERENCE_DISTANCE, mRefDist);
-    alSourcef(mId, AL_MAX_DISTANCE, mMaxDist);
-    alSourcefv(mId, AL_POSITION, mPosition.getPtr());
-    alSourcefv(mId, AL_VELOCITY, mVelocity.getPtr());
-    alSourcefv(mId, AL_DIRECTION, mDirection.getPtr());
-    if(mContext->hasExtension(EXT_BFORMAT))
-        alSourcefv(mId, AL_ORIENTATION, &mOrientation[0][0]);
-    alSourcef(mId, AL_CONE_INNER_ANGLE, mConeInnerAngle);
-    alSourcef(mId, AL_CONE_OUTER_ANGLE, mConeOuterAngle);
-    alSourcef(mId, AL_CONE_OUTER_GAIN, mConeOuterGain);
-    alSourcef(mId, AL_ROLLOFF_FACTOR, mRolloffFactor);
-    alSourcef(mId, AL_DOPPLER_FACTOR, mDopplerFactor);
-    if(mContext->hasExtension(EXT_SOURCE_RADIUS))
-        alSourcef(mId, AL_SOURCE_RADIUS, mRadius);
-    if(mContext->hasExtension(EXT_STEREO_ANGLES))
-        alSourcefv(mId, AL_STEREO_ANGLES, mStereoAngles);
-    alSourcei(mId, AL_SOURCE_RELATIVE, mRelative ? AL_TRUE : AL_FALSE);
+        alSourcei(mId, AL_SAMPLE_OFFSET, offset);
+        calls += 1;
+    }
+    mDirty = fresh ? getNonDefaultProps() : DirtyAll;
+    commitProperties();
+
     if(mContext->hasExtension(EXT_EFX))
     {
-        alSourcef(mId, AL_CONE_OUTER_GAINHF, mConeOuterGainHF);
-        alSourcef(mId, AL_ROOM_ROLLOFF_FACTOR, mRoomRolloffFactor);
-        alSourcef(mId, AL_AIR_ABSORPTION_FACTOR, mAirAbsorptionFactor);
-        alSourcei(mId, AL_DIRECT_FILTER_GAINHF_AUTO, mDryGainHFAuto ? AL_TRUE : AL_FALSE);
-        alSourcei(mId, AL_AUXILIARY_SEND_FILTER_GAIN_AUTO, mWetGainAuto ? AL_TRUE : AL_FALSE);
-        alSourcei(mId, AL_AUXILIARY_SEND_FILTER_GAINHF_AUTO, mWetGainHFAuto ? AL_TRUE : AL_FALSE);
-        alSourcei(mId, AL_DIRECT_FILTER, mDirectFilter);
+        if(!fresh || mDirectFilter != AL_FILTER_NULL)
+        {
+            alSourcei(mId, AL_DIRECT_FILTER, mDirectFilter);
+            calls += 1;
+        }
         for(const auto &i : mEffectSlots)
         {
             ALuint slotid = (i.second.mSlot ? i.second.mSlot->getId() : 0);
             alSource3i(mId, AL_AUXILIARY_SEND_FILTER, slotid, i.first, i.second.mFilter);
         }
+        calls += mEffectSlots.size();
     }
+    mContext->addALCalls(calls);
+}
+
+void ALSource::commitProperties()
+{
+    ALuint dirty = mDirty;
+    mDirty = 0;
+    if(mId == 0 || !dirty)
+        return;
+
+    ALuint calls = 0;
+    if((dirty&DirtyPitch))
+    {
+        alSourcef(mId, AL_PITCH, mPitch * (mGroup ? mGroup->getAppliedPitch() : 1.0f));
+        calls += 1;
+    }
+    if((dirty&DirtyGain))
+    {
+        alSourcef(mId, AL_GAIN, mGain * (mGroup ? mGroup->getAppliedGain() : 1.0f));
+        calls += 1;
+    }
+    if((dirty&DirtyGainRange))
+    {
+        alSourcef(mId, AL_MIN_GAIN, mMinGain);
+        alSourcef(mId, AL_MAX_GAIN, mMaxGain);
+        calls += 2;
+    }
+    if((dirty&DirtyDistanceRange))
+    {
+        alSourcef(mId, AL_REFERENCE_DISTANCE, mRefDist);
+        alSourcef(mId, AL_MAX_DISTANCE, mMaxDist);
+        calls += 2;
+    }
+    if((dirty&DirtyPosition))
+    {
+        alSourcefv(mId, AL_POSITION, mPosition.getPtr());
+        calls += 1;
+    }
+    if((dirty&DirtyVelocity))
+    {
+        alSourcefv(mId, AL_VELOCITY, mVelocity.getPtr());
+        calls += 1;
+    }
+    if((dirty&DirtyDirection))
+    {
+        alSourcefv(mId, AL_DIRECTION, mDirection.getPtr());
+        calls += 1;
+    }
+    if((dirty&DirtyOrientation) && mContext->hasExtension(EXT_BFORMAT))
+    {
+        alSourcefv(mId, AL_ORIENTATION, &mOrientation[0][0]);
+        calls += 1;
+    }
+    if((dirty&DirtyConeAngles))
+    {
+        alSourcef(mId, AL_CONE_INNER_ANGLE, mConeInnerAngle);
+        alSourcef(mId, AL_CONE_OUTER_ANGLE, mConeOuterAngle);
+        calls += 2;
+    }
+    if((dirty&DirtyConeGains))
+    {
+        alSourcef(mId, AL_CONE_OUTER_GAIN, mConeOuterGain);
+        calls += 1;
+        if(mContext->hasExtension(EXT_EFX))
+        {
+            alSourcef(mId, AL_CONE_OUTER_GAINHF, mConeOuterGainHF);
+            calls += 1;
+        }
+    }
+    if((dirty&DirtyRolloff))
+    {
+        alSourcef(mId, AL_ROLLOFF_FACTOR, mRolloffFactor);
+        calls += 1;
+        if(mContext->hasExtension(EXT_EFX))
+        {
+            alSourcef(mId, AL_ROOM_ROLLOFF_FACTOR, mRoomRolloffFactor);
+            calls += 1;
+        }
+    }
+    if((dirty&DirtyDoppler))
+    {
+        alSourcef(mId, AL_DOPPLER_FACTOR, mDopplerFactor);
+        calls += 1;
+    }
+    if((dirty&DirtyAirAbsorption) && mContext->hasExtension(EXT_EFX))
+    {
+        alSourcef(mId, AL_AIR_ABSORPTION_FACTOR, mAirAbsorptionFactor);
+        calls += 1;
+    }
+    if((dirty&DirtyRadius) && mContext->hasExtension(EXT_SOURCE_RADIUS))
+    {
+        alSourcef(mId, AL_SOURCE_RADIUS, mRadius);
+        calls += 1;
+    }
+    if((dirty&DirtyStereoAngles) && mContext->hasExtension(EXT_STEREO_ANGLES))
+    {
+        alSourcefv(mId, AL_STEREO_ANGLES, mStereoAngles);
+        calls += 1;
+    }
+    if((dirty&DirtyRelative))
+    {
+        alSourcei(mId, AL_SOURCE_RELATIVE, mRelative ? AL_TRUE : AL_FALSE);
+        calls += 1;
+    }
+    if((dirty&DirtyGainAuto) && mContext->hasExtension(EXT_EFX))
+    {
+        alSourcei(mId, AL_DIRECT_FILTER_GAINHF_AUTO, mDryGainHFAuto ? AL_TRUE : AL_FALSE);
+        alSourcei(mId, AL_AUXILIARY_SEND_FILTER_GAIN_AUTO, mWetGainAuto ? AL_TRUE : AL_FALSE);
+        alSourcei(mId, AL_AUXILIARY_SEND_FILTER_GAINHF_AUTO, mWetGainHFAuto ? AL_TRUE : AL_FALSE);
+        calls += 3;
+    }
+    mContext->addALCalls(calls);
 }
 
 
@@ -290,33 +570,22 @@ void ALSource::unsetGroup()
 
 void ALSource::groupUpdate()
 {
-    if(mId)
-    {
-        if(mGroup)
-        {
-            alSourcef(mId, AL_PITCH, mPitch * mGroup->getAppliedPitch());
-            alSourcef(mId, AL_GAIN, mGain * mGroup->getAppliedGain());
-        }
-        else
-        {
-            alSourcef(mId, AL_PITCH, mPitch);
-            alSourcef(mId, AL_GAIN, mGain);
-        }
-    }
+    setStreamPitch(mPitch * (mGroup ? mGroup->getAppliedPitch() : 1.0f));
+    markDirty(DirtyPitch | DirtyGain);
 }
 
-void ALSource::groupPropUpdate(ALfloat gain, ALfloat pitch)
+void ALSource::groupPropUpdate(ALfloat pitch)
 {
-    if(mId)
-    {
-        alSourcef(mId, AL_PITCH, mPitch * pitch);
-        alSourcef(mId, AL_GAIN, mGain * gain);
-    }
+    // commitProperties applies the group's gain and pitch along with the
+    // source's own.
+    setStreamPitch(mPitch * pitch);
+    markDirty(DirtyPitch | DirtyGain);
 }
 
 
 void ALSource::play(Buffer *buffer)
 {
+    ALURE_TRACE_ZONE("ALSource::play");
     ALBuffer *albuf = cast<ALBuffer*>(buffer);
     if(!albuf) throw std::runtime_error("Buffer is not valid");
     CheckContext(mContext);
@@ -330,19 +599,24 @@ void ALSource::play(Buffer *buffer)
         mContext->removeStream(this);
         mIsAsync.store(false, std::memory_order_release);
     }
+    setVirtual(false);
 
     if(mId == 0)
     {
-        mId = mContext->getSourceId(mPriority);
-        applyProperties(mLooping, (ALuint)std::min<uint64_t>(mOffset, std::numeric_limits<ALint>::max()));
+        bool fresh = false;
+        mId = mContext->getSourceId(mPriority, fresh);
+        applyProperties(mLooping, (ALuint)std::min<uint64_t>(mOffset, std::numeric_limits<ALint>::max()), fresh);
     }
     else
     {
+        commitProperties();
         alSourceRewind(mId);
         alSourcei(mId, AL_BUFFER, 0);
         alSourcei(mId, AL_LOOPING, mLooping ? AL_TRUE : AL_FALSE);
         alSourcei(mId, AL_SAMPLE_OFFSET, (ALuint)std::min<uint64_t>(mOffset, std::numeric_limits<ALint>::max()));
     }
+    mClockOffset = mOffset;
+    mClockStart = mContext->getClockTime();
     mOffset = 0;
 
     mStream.reset();
@@ -355,6 +629,7 @@ void ALSource::play(Buffer *buffer)
     alSourcei(mId, AL_BUFFER, mBuffer->getId());
     alSourcePlay(mId);
     mPaused.store(false, std::memory_order_release);
+    mContext->addVoice(this);
 }
 
 void ALSource::play(SharedPtr<Decoder> decoder, ALuint updatelen, ALuint queuesize)
@@ -365,22 +640,45 @@ void ALSource::play(SharedPtr<Decoder> decoder, ALuint updatelen, ALuint queuesi
         throw std::runtime_error("Queue size out of range");
     CheckContext(mContext);
 
-    auto stream = MakeUnique<ALBufferStream>(decoder, updatelen, queuesize);
+    playStream(MakeUnique<ALBufferStream>(mContext, decoder, updatelen, updatelen,
+                                          queuesize, queuesize));
+}
+
+void ALSource::playAdaptive(SharedPtr<Decoder> decoder, ALuint minupdatelen, ALuint maxupdatelen,
+                            ALuint minqueuesize, ALuint maxqueuesize)
+{
+    if(minupdatelen < 64 || maxupdatelen < minupdatelen)
+        throw std::runtime_error("Update length out of range");
+    if(minqueuesize < 2 || maxqueuesize < minqueuesize)
+        throw std::runtime_error("Queue size out of range");
+    CheckContext(mContext);
+
+    playStream(MakeUnique<ALBufferStream>(mContext, decoder, minupdatelen, maxupdatelen,
+                                          minqueuesize, maxqueuesize));
+}
+
+void ALSource::playStream(UniquePtr<ALBufferStream> stream)
+{
+    ALURE_TRACE_ZONE("ALSource::playStream");
     stream->prepare();
+    stream->setLooping(mLooping);
 
     if(mIsAsync.load(std::memory_order_acquire))
     {
         mContext->removeStream(this);
         mIsAsync.store(false, std::memory_order_release);
     }
+    setVirtual(false);
 
     if(mId == 0)
     {
-        mId = mContext->getSourceId(mPriority);
-        applyProperties(false, 0);
+        bool fresh = false;
+        mId = mContext->getSourceId(mPriority, fresh);
+        applyProperties(false, 0, fresh);
     }
     else
     {
+        commitProperties();
         alSourceRewind(mId);
         alSourcei(mId, AL_BUFFER, 0);
         alSourcei(mId, AL_LOOPING, AL_FALSE);
@@ -398,17 +696,49 @@ void ALSource::play(SharedPtr<Decoder> decoder, ALuint updatelen, ALuint queuesi
 
     for(ALuint i = 0;i < mStream->getNumUpdates();i++)
     {
-        if(!mStream->streamMoreData(mId, mLooping))
+        if(!mStream->streamMoreData(mId))
             break;
     }
     alSourcePlay(mId);
     mPaused.store(false, std::memory_order_release);
+    mContext->addVoice(this);
+
+    mContext->startAsyncThreads();
+    mStream->scheduleDecode();
 
     mContext->addStream(this);
     mIsAsync.store(true, std::memory_order_release);
 }
 
 
+void ALSource::releaseId()
+{
+    alSourceRewind(mId);
+    alSourcei(mId, AL_BUFFER, 0);
+    mContext->addALCalls(2);
+    if(mContext->hasExtension(EXT_EFX))
+    {
+        alSourcei(mId, AL_DIRECT_FILTER, AL_FILTER_NULL);
+        for(auto &i : mEffectSlots)
+            alSource3i(mId, AL_AUXILIARY_SEND_FILTER, 0, i.first, AL_FILTER_NULL);
+        mContext->addALCalls(1 + mEffectSlots.size());
+    }
+    mContext->removeVoice(this);
+    mContext->insertSourceId(mId);
+    mId = 0;
+    // Everything is given to OpenAL again when it gets a new source.
+    mDirty = 0;
+}
+
+void ALSource::setVirtual(bool isvirtual)
+{
+    if(mVirtual != isvirtual)
+    {
+        mVirtual = isvirtual;
+        mContext->countVirtualSource(isvirtual);
+    }
+}
+
 void ALSource::makeStopped()
 {
     if(mIsAsync.load(std::memory_order_acquire))
@@ -418,18 +748,7 @@ void ALSource::makeStopped()
     }
 
     if(mId != 0)
-    {
-        alSourceRewind(mId);
-        alSourcei(mId, AL_BUFFER, 0);
-        if(mContext->hasExtension(EXT_EFX))
-        {
-            alSourcei(mId, AL_DIRECT_FILTER, AL_FILTER_NULL);
-            for(auto &i : mEffectSlots)
-                alSource3i(mId, AL_AUXILIARY_SEND_FILTER, 0, i.first, AL_FILTER_NULL);
-        }
-        mContext->insertSourceId(mId);
-        mId = 0;
-    }
+        releaseId();
 
     if(mBuffer)
         mBuffer->removeSource(this);
@@ -438,6 +757,119 @@ void ALSource::makeStopped()
     mStream.reset();
 
     mPaused.store(false, std::memory_order_release);
+    setVirtual(false);
+}
+
+
+uint64_t ALSource::getClockOffset() const
+{
+    uint64_t offset = mClockOffset;
+    if(!mPaused.load(std::memory_order_acquire))
+    {
+        std::chrono::duration<double> elapsed = mContext->getClockTime() - mClockStart;
+        ALfloat pitch = mPitch * (mGroup ? mGroup->getAppliedPitch() : 1.0f);
+        offset += static_cast<uint64_t>(elapsed.count() * mBuffer->getFrequency() * pitch);
+    }
+    std::pair<ALuint,ALuint> looppts = mBuffer->getLoopPoints();
+    if(mLooping && offset >= looppts.second && looppts.second > looppts.first)
+    {
+        uint64_t looplen = looppts.second - looppts.first;
+        offset = looppts.first + (offset - looppts.first)%looplen;
+    }
+    return offset;
+}
+
+void ALSource::rebaseClock()
+{
+    // Restarts tracking from the current position, for when something changes
+    // how fast it advances.
+    mClockOffset = getClockOffset();
+    mClockStart = mContext->getClockTime();
+}
+
+ALfloat ALSource::getAudibleGain(const Vector3 &listener, DistanceModel model) const
+{
+    ALfloat gain = mGain * (mGroup ? mGroup->getAppliedGain() : 1.0f);
+    ALfloat dist = mRelative ? mPosition.getLength() : mPosition.getDistance(listener);
+
+    // Follows the distance models as specified by OpenAL.
+    if(model == DistanceModel::InverseClamped || model == DistanceModel::LinearClamped ||
+       model == DistanceModel::ExponentClamped)
+        dist = std::min(std::max(dist, mRefDist), mMaxDist);
+    switch(model)
+    {
+        case DistanceModel::InverseClamped:
+        case DistanceModel::Inverse:
+            if(mRefDist > 0.0f)
+            {
+                ALfloat denom = mRefDist + mRolloffFactor*(dist - mRefDist);
+                if(denom > 0.0f) gain *= mRefDist / denom;
+            }
+            break;
+
+        case DistanceModel::LinearClamped:
+        case DistanceModel::Linear:
+            if(mMaxDist > mRefDist)
+            {
+                ALfloat atten = 1.0f - mRolloffFactor*(std::min(dist, mMaxDist) - mRefDist) /
+                                       (mMaxDist - mRefDist);
+                gain *= std::max(atten, 0.0f);
+            }
+            break;
+
+        case DistanceModel::ExponentClamped:
+        case DistanceModel::Exponent:
+            if(dist > 0.0f && mRefDist > 0.0f)
+                gain *= std::pow(dist / mRefDist, -mRolloffFactor);
+            break;
+
+        case DistanceModel::None:
+            break;
+    }
+
+    return std::min(std::max(gain, mMinGain), mMaxGain);
+}
+
+ALfloat ALSource::getRemainingTime() const
+{
+    // Streams have no known end.
+    if(!mBuffer || mLooping)
+        return std::numeric_limits<ALfloat>::infinity();
+
+    uint64_t offset = getClockOffset();
+    ALuint length = mBuffer->getLength();
+    if(offset >= length)
+        return 0.0f;
+    ALfloat pitch = mPitch * (mGroup ? mGroup->getAppliedPitch() : 1.0f);
+    return (length - offset) / (mBuffer->getFrequency() * pitch);
+}
+
+void ALSource::makeVirtual()
+{
+    ALint state = -1, srcpos = 0;
+    alGetSourcei(mId, AL_SOURCE_STATE, &state);
+    alGetSourcei(mId, AL_SAMPLE_OFFSET, &srcpos);
+    mContext->addALCalls(2);
+
+    // A source that just finished is left to stop on the next update.
+    mClockOffset = (state == AL_STOPPED) ? mBuffer->getLength() : srcpos;
+    mClockStart = mContext->getClockTime();
+    setVirtual(true);
+
+    releaseId();
+}
+
+void ALSource::makeReal(ALuint id, bool fresh)
+{
+    rebaseClock();
+    setVirtual(false);
+
+    mId = id;
+    applyProperties(mLooping, (ALuint)std::min<uint64_t>(mClockOffset, std::numeric_limits<ALint>::max()), fresh);
+    alSourcei(mId, AL_BUFFER, mBuffer->getId());
+    alSourcePlay(mId);
+    mContext->addALCalls(2);
+    mContext->addVoice(this);
 }
 
 void ALSource::stop()
@@ -449,7 +881,17 @@ void ALSource::stop()
 
 void ALSource::checkPaused()
 {
-    if(mPaused.load(std::memory_order_acquire) || mId == 0)
+    if(mPaused.load(std::memory_order_acquire))
+        return;
+    if(mBuffer)
+        rebaseClock();
+    if(mVirtual)
+    {
+        // Paused along with its group.
+        mPaused.store(true, std::memory_order_release);
+        return;
+    }
+    if(mId == 0)
         return;
 
     ALint state = -1;
@@ -466,7 +908,11 @@ void ALSource::pause()
     if(mPaused.load(std::memory_order_acquire))
         return;
 
-    if(mId != 0)
+    if(mBuffer)
+        rebaseClock();
+    if(mVirtual)
+        mPaused.store(true, std::memory_order_release);
+    else if(mId != 0)
     {
         std::lock_guard<std::mutex> lock(mMutex);
         alSourcePause(mId);
@@ -485,15 +931,37 @@ void ALSource::resume()
     if(!mPaused.load(std::memory_order_acquire))
         return;
 
-    if(mId != 0)
+    if(mBuffer)
+        mClockStart = mContext->getClockTime();
+    if(!mVirtual && mId != 0)
         alSourcePlay(mId);
-    mPaused.store(false, std::memory_order_release);
+    if(!mIsAsync.load(std::memory_order_acquire))
+        mPaused.store(false, std::memory_order_release);
+    else
+    {
+        auto lock = mContext->getSourceStreamLock();
+        unsetPaused();
+    }
+}
+
+void ALSource::unsetPaused()
+{
+    if(!mPaused.exchange(false, std::memory_order_acq_rel))
+        return;
+    if(mBuffer)
+        mClockStart = mContext->getClockTime();
+    else if(mIsAsync.load(std::memory_order_acquire))
+    {
+        // A paused stream isn't scheduled, so it needs to be woken back up.
+        mContext->scheduleStreamNoLock(this);
+    }
 }
 
 
 bool ALSource::isPlaying() const
 {
     CheckContext(mContext);
+    if(mVirtual) return !mPaused.load(std::memory_order_acquire);
     if(mId == 0) return false;
 
     ALint state = -1;
@@ -508,6 +976,7 @@ bool ALSource::isPlaying() const
 bool ALSource::isPaused() const
 {
     CheckContext(mContext);
+    if(mVirtual) return mPaused.load(std::memory_order_acquire);
     if(mId == 0) return false;
 
     ALint state = -1;
@@ -527,6 +996,7 @@ ALint ALSource::refillBufferStream()
     {
         ALuint buf;
         alSourceUnqueueBuffers(mId, 1, &buf);
+        mStream->bufferProcessed(buf);
         --processed;
     }
 
@@ -534,9 +1004,10 @@ ALint ALSource::refillBufferStream()
     alGetSourcei(mId, AL_BUFFERS_QUEUED, &queued);
     for(;(ALuint)queued < mStream->getNumUpdates();queued++)
     {
-        if(!mStream->streamMoreData(mId, mLooping))
+        if(!mStream->streamMoreData(mId))
             break;
     }
+    mStream->scheduleDecode();
 
     return queued;
 }
@@ -545,11 +1016,21 @@ ALint ALSource::refillBufferStream()
 void ALSource::update()
 {
     CheckContext(mContext);
+    commitProperties();
     updateNoCtxCheck();
 }
 
 void ALSource::updateNoCtxCheck()
 {
+    if(mVirtual)
+    {
+        if(!mLooping && getClockOffset() >= mBuffer->getLength())
+        {
+            stop();
+            mContext->send(&MessageHandler::sourceStopped, this, false);
+        }
+        return;
+    }
     if(mId == 0)
         return;
 
@@ -565,6 +1046,7 @@ void ALSource::updateNoCtxCheck()
     {
         ALint state = -1;
         alGetSourcei(mId, AL_SOURCE_STATE, &state);
+        mContext->addALCalls(1);
         if(state != AL_PLAYING && state != AL_PAUSED)
         {
             stop();
@@ -573,39 +1055,77 @@ void ALSource::updateNoCtxCheck()
     }
 }
 
-bool ALSource::updateAsync()
+bool ALSource::updateAsync(std::chrono::nanoseconds &delay)
 {
     std::lock_guard<std::mutex> lock(mMutex);
 
     ALint queued = refillBufferStream();
     if(queued == 0)
     {
+        // Keep waiting if the decode threads just haven't caught up.
+        if(mStream->hasMoreData())
+        {
+            mStream->underrun();
+            delay = std::chrono::nanoseconds(-1);
+            return true;
+        }
         mIsAsync.store(false, std::memory_order_release);
         return false;
     }
-    if(!mPaused.load(std::memory_order_acquire))
+    if(mPaused.load(std::memory_order_acquire))
     {
-        ALint state = -1;
-        alGetSourcei(mId, AL_SOURCE_STATE, &state);
-        if(state != AL_PLAYING)
-        {
-            refillBufferStream();
-            alSourcePlay(mId);
-        }
+        // Nothing plays until it's resumed, which reschedules it.
+        delay = std::chrono::nanoseconds::max();
+        return true;
+    }
+
+    ALint state = -1;
+    alGetSourcei(mId, AL_SOURCE_STATE, &state);
+    if(state != AL_PLAYING)
+    {
+        // The queue ran out before it was refilled.
+        mStream->underrun();
+        refillBufferStream();
+        alSourcePlay(mId);
     }
+
+    // The next refill is due once the oldest buffer is done, which leaves the
+    // rest of the queue as a margin for pitch changes and timer slop.
+    ALint srcpos = 0;
+    alGetSourcei(mId, AL_SAMPLE_OFFSET, &srcpos);
+    delay = mStream->getFrontRemaining(srcpos, mStreamPitch.load(std::memory_order_relaxed));
     return true;
 }
 
+void ALSource::setStreamPitch(ALfloat pitch)
+{
+    ALfloat oldpitch = mStreamPitch.exchange(pitch, std::memory_order_relaxed);
+    // A higher pitch drains the queue before the scheduled refill, so have
+    // the stream checked again now.
+    if(pitch > oldpitch && mIsAsync.load(std::memory_order_acquire))
+        mContext->rescheduleStream(this);
+}
+
 
 void ALSource::setPriority(ALuint priority)
 {
     mPriority = priority;
+    if(mVoiceIndex != std::numeric_limits<size_t>::max())
+        mContext->updateVoice(this);
 }
 
 
 void ALSource::setOffset(uint64_t offset)
 {
     CheckContext(mContext);
+    if(mVirtual)
+    {
+        if(offset >= mBuffer->getLength())
+            throw std::runtime_error("Offset out of range");
+        mClockOffset = offset;
+        mClockStart = mContext->getClockTime();
+        return;
+    }
     if(mId == 0)
     {
         mOffset = offset;
@@ -620,6 +1140,8 @@ void ALSource::setOffset(uint64_t offset)
         alSourcei(mId, AL_SAMPLE_OFFSET, (ALint)offset);
         if(alGetError() != AL_NO_ERROR)
             throw std::runtime_error("Offset out of range");
+        mClockOffset = offset;
+        mClockStart = mContext->getClockTime();
     }
     else
     {
@@ -628,6 +1150,7 @@ void ALSource::setOffset(uint64_t offset)
             throw std::runtime_error("Failed to seek to offset");
         alSourceRewind(mId);
         alSourcei(mId, AL_BUFFER, 0);
+        mStream->resetQueue();
         ALint queued = refillBufferStream();
         if(queued > 0 && !mPaused)
             alSourcePlay(mId);
@@ -637,6 +1160,12 @@ void ALSource::setOffset(uint64_t offset)
 uint64_t ALSource::getOffset(uint64_t *latency) const
 {
     CheckContext(mContext);
+    if(mVirtual)
+    {
+        if(latency)
+            *latency = 0;
+        return std::min<uint64_t>(getClockOffset(), mBuffer->getLength());
+    }
     if(mId == 0)
     {
         if(latency)
@@ -667,7 +1196,7 @@ uint64_t ALSource::getOffset(uint64_t *latency) const
         if(state != AL_STOPPED)
         {
             // The amount of samples in the queue waiting to play
-            ALuint inqueue = queued*mStream->getUpdateLength() - srcpos;
+            ALuint inqueue = mStream->getQueuedFrames() - srcpos;
 
             if(pos >= inqueue)
             {
@@ -718,8 +1247,12 @@ void ALSource::setLooping(bool looping)
 {
     CheckContext(mContext);
 
+    if(mBuffer)
+        rebaseClock();
     if(mId && !mStream)
         alSourcei(mId, AL_LOOPING, looping ? AL_TRUE : AL_FALSE);
+    if(mStream)
+        mStream->setLooping(looping);
     mLooping = looping;
 }
 
@@ -729,9 +1262,10 @@ void ALSource::setPitch(ALfloat pitch)
     if(!(pitch > 0.0f))
         throw std::runtime_error("Pitch out of range");
     CheckContext(mContext);
-    if(mId != 0)
-        alSourcef(mId, AL_PITCH, pitch * (mGroup ? mGroup->getAppliedPitch() : 1.0f));
+    if(mBuffer) rebaseClock();
     mPitch = pitch;
+    setStreamPitch(mPitch * (mGroup ? mGroup->getAppliedPitch() : 1.0f));
+    markDirty(DirtyPitch);
 }
 
 
@@ -740,9 +1274,8 @@ void ALSource::setGain(ALfloat gain)
     if(!(gain >= 0.0f))
         throw std::runtime_error("Gain out of range");
     CheckContext(mContext);
-    if(mId != 0)
-        alSourcef(mId, AL_GAIN, gain * (mGroup ? mGroup->getAppliedGain() : 1.0f));
     mGain = gain;
+    markDirty(DirtyGain);
 }
 
 void ALSource::setGainRange(ALfloat mingain, ALfloat maxgain)
@@ -750,13 +1283,9 @@ void ALSource::setGainRange(ALfloat mingain, ALfloat maxgain)
     if(!(mingain >= 0.0f && maxgain <= 1.0f && maxgain >= mingain))
         throw std::runtime_error("Gain range out of range");
     CheckContext(mContext);
-    if(mId != 0)
-    {
-        alSourcef(mId, AL_MIN_GAIN, mingain);
-        alSourcef(mId, AL_MAX_GAIN, maxgain);
-    }
     mMinGain = mingain;
     mMaxGain = maxgain;
+    markDirty(DirtyGainRange);
 }
 
 
@@ -765,127 +1294,100 @@ void ALSource::setDistanceRange(ALfloat refdist, ALfloat maxdist)
     if(!(refdist >= 0.0f && maxdist <= std::numeric_limits<float>::max() && refdist <= maxdist))
         throw std::runtime_error("Distance range out of range");
     CheckContext(mContext);
-    if(mId != 0)
-    {
-        alSourcef(mId, AL_REFERENCE_DISTANCE, refdist);
-        alSourcef(mId, AL_MAX_DISTANCE, maxdist);
-    }
     mRefDist = refdist;
     mMaxDist = maxdist;
+    markDirty(DirtyDistanceRange);
 }
 
 
 void ALSource::setPosition(ALfloat x, ALfloat y, ALfloat z)
 {
     CheckContext(mContext);
-    if(mId != 0)
-        alSource3f(mId, AL_POSITION, x, y, z);
     mPosition[0] = x;
     mPosition[1] = y;
     mPosition[2] = z;
+    markDirty(DirtyPosition);
 }
 
 void ALSource::setPosition(const ALfloat *pos)
 {
     CheckContext(mContext);
-    if(mId != 0)
-        alSourcefv(mId, AL_POSITION, pos);
     mPosition[0] = pos[0];
     mPosition[1] = pos[1];
     mPosition[2] = pos[2];
+    markDirty(DirtyPosition);
 }
 
 void ALSource::setVelocity(ALfloat x, ALfloat y, ALfloat z)
 {
     CheckContext(mContext);
-    if(mId != 0)
-        alSource3f(mId, AL_VELOCITY, x, y, z);
     mVelocity[0] = x;
     mVelocity[1] = y;
     mVelocity[2] = z;
+    markDirty(DirtyVelocity);
 }
 
 void ALSource::setVelocity(const ALfloat *vel)
 {
     CheckContext(mContext);
-    if(mId != 0)
-        alSourcefv(mId, AL_VELOCITY, vel);
     mVelocity[0] = vel[0];
     mVelocity[1] = vel[1];
     mVelocity[2] = vel[2];
+    markDirty(DirtyVelocity);
 }
 
 void ALSource::setDirection(ALfloat x, ALfloat y, ALfloat z)
 {
     CheckContext(mContext);
-    if(mId != 0)
-        alSource3f(mId, AL_DIRECTION, x, y, z);
     mDirection[0] = x;
     mDirection[1] = y;
     mDirection[2] = z;
+    markDirty(DirtyDirection);
 }
 
 void ALSource::setDirection(const ALfloat *dir)
 {
     CheckContext(mContext);
-    if(mId != 0)
-        alSourcefv(mId, AL_DIRECTION, dir);
     mDirection[0] = dir[0];
     mDirection[1] = dir[1];
     mDirection[2] = dir[2];
+    markDirty(DirtyDirection);
 }
 
 void ALSource::setOrientation(ALfloat x1, ALfloat y1, ALfloat z1, ALfloat x2, ALfloat y2, ALfloat z2)
 {
     CheckContext(mContext);
-    if(mId != 0)
-    {
-        ALfloat ori[6] = { x1, y1, z1, x2, y2, z2 };
-        if(mContext->hasExtension(EXT_BFORMAT))
-            alSourcefv(mId, AL_ORIENTATION, ori);
-        alSourcefv(mId, AL_DIRECTION, ori);
-    }
     mDirection[0] = mOrientation[0][0] = x1;
     mDirection[1] = mOrientation[0][1] = y1;
     mDirection[2] = mOrientation[0][2] = z1;
     mOrientation[1][0] = x2;
     mOrientation[1][1] = y2;
     mOrientation[1][2] = z2;
+    markDirty(DirtyDirection | DirtyOrientation);
 }
 
 void ALSource::setOrientation(const ALfloat *at, const ALfloat *up)
 {
     CheckContext(mContext);
-    if(mId != 0)
-    {
-        ALfloat ori[6] = { at[0], at[1], at[2], up[0], up[1], up[2] };
-        if(mContext->hasExtension(EXT_BFORMAT))
-            alSourcefv(mId, AL_ORIENTATION, ori);
-        alSourcefv(mId, AL_DIRECTION, ori);
-    }
     mDirection[0] = mOrientation[0][0] = at[0];
     mDirection[1] = mOrientation[0][1] = at[1];
     mDirection[2] = mOrientation[0][2] = at[2];
     mOrientation[1][0] = up[0];
     mOrientation[1][1] = up[1];
     mOrientation[1][2] = up[2];
+    markDirty(DirtyDirection | DirtyOrientation);
 }
 
 void ALSource::setOrientation(const ALfloat *ori)
 {
     CheckContext(mContext);
-    if(mId != 0)
-    {
-        if(mContext->hasExtension(EXT_BFORMAT))
-            alSourcefv(mId, AL_ORIENTATION, ori);
-        alSourcefv(mId, AL_DIRECTION, ori);
-    }
     mDirection[0] = mOrientation[0][0] = ori[0];
     mDirection[1] = mOrientation[0][1] = ori[1];
     mDirection[2] = mOrientation[0][2] = ori[2];
     mOrientation[1][0] = ori[3];
     mOrientation[1][1] = ori[4];
     mOrientation[1][2] = ori[5];
+    markDirty(DirtyDirection | DirtyOrientation);
 }
 
 
@@ -894,13 +1396,9 @@ void ALSource::setConeAngles(ALfloat inner, ALfloat outer)
     if(!(inner >= 0.0f && outer <= 360.0f && outer >= inner))
         throw std::runtime_error("Cone angles out of range");
     CheckContext(mContext);
-    if(mId != 0)
-    {
-        alSourcef(mId, AL_CONE_INNER_ANGLE, inner);
-        alSourcef(mId, AL_CONE_OUTER_ANGLE, outer);
-    }
     mConeInnerAngle = inner;
     mConeOuterAngle = outer;
+    markDirty(DirtyConeAngles);
 }
 
 void ALSource::setOuterConeGains(ALfloat gain, ALfloat gainhf)
@@ -908,14 +1406,9 @@ void ALSource::setOuterConeGains(ALfloat gain, ALfloat gainhf)
     if(!(gain >= 0.0f && gain <= 1.0f && gainhf >= 0.0f && gainhf <= 1.0f))
         throw std::runtime_error("Outer cone gain out of range");
     CheckContext(mContext);
-    if(mId != 0)
-    {
-        alSourcef(mId, AL_CONE_OUTER_GAIN, gain);
-        if(mContext->hasExtension(EXT_EFX))
-            alSourcef(mId, AL_CONE_OUTER_GAINHF, gainhf);
-    }
     mConeOuterGain = gain;
     mConeOuterGainHF = gainhf;
+    markDirty(DirtyConeGains);
 }
 
 
@@ -924,14 +1417,9 @@ void ALSource::setRolloffFactors(ALfloat factor, ALfloat roomfactor)
     if(!(factor >= 0.0f && roomfactor >= 0.0f))
         throw std::runtime_error("Rolloff factor out of range");
     CheckContext(mContext);
-    if(mId != 0)
-    {
-        alSourcef(mId, AL_ROLLOFF_FACTOR, factor);
-        if(mContext->hasExtension(EXT_EFX))
-            alSourcef(mId, AL_ROOM_ROLLOFF_FACTOR, roomfactor);
-    }
     mRolloffFactor = factor;
     mRoomRolloffFactor = roomfactor;
+    markDirty(DirtyRolloff);
 }
 
 void ALSource::setDopplerFactor(ALfloat factor)
@@ -939,9 +1427,8 @@ void ALSource::setDopplerFactor(ALfloat factor)
     if(!(factor >= 0.0f && factor <= 1.0f))
         throw std::runtime_error("Doppler factor out of range");
     CheckContext(mContext);
-    if(mId != 0)
-        alSourcef(mId, AL_DOPPLER_FACTOR, factor);
     mDopplerFactor = factor;
+    markDirty(DirtyDoppler);
 }
 
 void ALSource::setAirAbsorptionFactor(ALfloat factor)
@@ -949,9 +1436,8 @@ void ALSource::setAirAbsorptionFactor(ALfloat factor)
     if(!(factor >= 0.0f && factor <= 10.0f))
         throw std::runtime_error("Absorption factor out of range");
     CheckContext(mContext);
-    if(mId != 0 && mContext->hasExtension(EXT_EFX))
-        alSourcef(mId, AL_AIR_ABSORPTION_FACTOR, factor);
     mAirAbsorptionFactor = factor;
+    markDirty(DirtyAirAbsorption);
 }
 
 void ALSource::setRadius(ALfloat radius)
@@ -959,43 +1445,32 @@ void ALSource::setRadius(ALfloat radius)
     if(!(mRadius >= 0.0f))
         throw std::runtime_error("Radius out of range");
     CheckContext(mContext);
-    if(mId != 0 && mContext->hasExtension(EXT_SOURCE_RADIUS))
-        alSourcef(mId, AL_SOURCE_RADIUS, radius);
     mRadius = radius;
+    markDirty(DirtyRadius);
 }
 
 void ALSource::setStereoAngles(ALfloat leftAngle, ALfloat rightAngle)
 {
     CheckContext(mContext);
-    if(mId != 0 && mContext->hasExtension(EXT_STEREO_ANGLES))
-    {
-        ALfloat angles[2] = { leftAngle, rightAngle };
-        alSourcefv(mId, AL_STEREO_ANGLES, angles);
-    }
     mStereoAngles[0] = leftAngle;
     mStereoAngles[1] = rightAngle;
+    markDirty(DirtyStereoAngles);
 }
 
 void ALSource::setRelative(bool relative)
 {
     CheckContext(mContext);
-    if(mId != 0)
-        alSourcei(mId, AL_SOURCE_RELATIVE, relative ? AL_TRUE : AL_FALSE);
     mRelative = relative;
+    markDirty(DirtyRelative);
 }
 
 void ALSource::setGainAuto(bool directhf, bool send, bool sendhf)
 {
     CheckContext(mContext);
-    if(mId != 0 && mContext->hasExtension(EXT_EFX))
-    {
-        alSourcei(mId, AL_DIRECT_FILTER_GAINHF_AUTO, directhf ? AL_TRUE : AL_FALSE);
-        alSourcei(mId, AL_AUXILIARY_SEND_FILTER_GAIN_AUTO, send ? AL_TRUE : AL_FALSE);
-        alSourcei(mId, AL_AUXILIARY_SEND_FILTER_GAINHF_AUTO, sendhf ? AL_TRUE : AL_FALSE);
-    }
     mDryGainHFAuto = directhf;
     mWetGainAuto = send;
     mWetGainHFAuto = sendhf;
+    markDirty(DirtyGainAuto);
 }
 
 
@@ -1179,18 +1654,7 @@ void ALSource::release()
     }
 
     if(mId != 0)
-    {
-        alSourceRewind(mId);
-        alSourcei(mId, AL_BUFFER, 0);
-        if(mContext->hasExtension(EXT_EFX))
-        {
-            alSourcei(mId, AL_DIRECT_FILTER, AL_FILTER_NULL);
-            for(auto &i : mEffectSlots)
-                alSource3i(mId, AL_AUXILIARY_SEND_FILTER, 0, i.first, AL_FILTER_NULL);
-        }
-        mContext->insertSourceId(mId);
-        mId = 0;
-    }
+        releaseId();
 
     mContext->freeSource(this);
 
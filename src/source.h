@@ -5,6 +5,7 @@
 
 #include <unordered_map>
 #include <atomic>
+#include <chrono>
 #include <mutex>
 
 #include "al.h"
@@ -42,6 +43,13 @@ class ALSource : public Source {
 
     mutable std::mutex mMutex;
     std::atomic<bool> mIsAsync;
+    // When the background thread next needs to service the stream. Protected
+    // by the context's source stream mutex.
+    std::chrono::steady_clock::time_point mStreamDeadline;
+    // The pitch with the group's applied, which the background thread times
+    // stream refills with. Only the app thread sets it.
+    std::atomic<ALfloat> mStreamPitch;
+    void setStreamPitch(ALfloat pitch);
 
     std::atomic<bool> mPaused;
     bool mLooping;
@@ -71,40 +79,158 @@ class ALSource : public Source {
 
     ALuint mPriority;
 
+    // Properties changed since they were last given to OpenAL.
+    enum DirtyFlags : ALuint {
+        DirtyPitch         = 1<<0,
+        DirtyGain          = 1<<1,
+        DirtyGainRange     = 1<<2,
+        DirtyDistanceRange = 1<<3,
+        DirtyPosition      = 1<<4,
+        DirtyVelocity      = 1<<5,
+        DirtyDirection     = 1<<6,
+        DirtyOrientation   = 1<<7,
+        DirtyConeAngles    = 1<<8,
+        DirtyConeGains     = 1<<9,
+        DirtyRolloff       = 1<<10,
+        DirtyDoppler       = 1<<11,
+        DirtyAirAbsorption = 1<<12,
+        DirtyRadius        = 1<<13,
+        DirtyStereoAngles  = 1<<14,
+        DirtyRelative      = 1<<15,
+        DirtyGainAuto      = 1<<16,
+
+        DirtyAll = (1<<17) - 1
+    };
+    ALuint mDirty;
+
+    // Set while the source plays a buffer without an OpenAL source, after
+    // being culled by the context.
+    bool mVirtual;
+    // Estimated play position in the buffer, tracked from a known offset and
+    // the time it was taken. A virtual source relies on it entirely, others
+    // only for ranking.
+    std::chrono::steady_clock::time_point mClockStart;
+    uint64_t mClockOffset;
+
+    uint64_t getClockOffset() const;
+    void rebaseClock();
+
+    // Ranking against other sources, refreshed by the context on update, and
+    // the position in its voice heap (-1 when not there).
+    ALfloat mVoiceGain;
+    ALfloat mVoiceScore;
+    size_t mVoiceIndex;
+
+    void releaseId();
+    // Also keeps the context's count of virtual sources.
+    void setVirtual(bool isvirtual);
+
+    void markDirty(ALuint flags);
+    ALuint getNonDefaultProps() const;
+
     void resetProperties();
-    void applyProperties(bool looping, ALuint offset) const;
+    void applyProperties(bool looping, ALuint offset, bool fresh);
 
     ALint refillBufferStream();
 
     void setFilterParams(ALuint &filterid, const FilterParams &params);
 
+    void playStream(UniquePtr<ALBufferStream> stream);
+
 public:
     ALSource(ALContext *context);
     ~ALSource();
 
     ALuint getId() const { return mId; }
+    ALContext *getContext() const { return mContext; }
+
+    // Sets the transform without checking the context, for bulk updates.
+    // Null pointers leave the property unchanged.
+    void setTransform(const ALfloat *pos, const ALfloat *vel, const ALfloat *dir)
+    {
+        ALuint flags = 0;
+        if(pos)
+        {
+            mPosition[0] = pos[0];
+            mPosition[1] = pos[1];
+            mPosition[2] = pos[2];
+            flags |= DirtyPosition;
+        }
+        if(vel)
+        {
+            mVelocity[0] = vel[0];
+            mVelocity[1] = vel[1];
+            mVelocity[2] = vel[2];
+            flags |= DirtyVelocity;
+        }
+        if(dir)
+        {
+            mDirection[0] = dir[0];
+            mDirection[1] = dir[1];
+            mDirection[2] = dir[2];
+            flags |= DirtyDirection;
+        }
+        markDirty(flags);
+    }
 
     void updateNoCtxCheck();
-    bool updateAsync();
+    // Gives OpenAL any properties changed since the last commit.
+    void commitProperties();
+    /* Refills the stream's queue. Returns false once the stream is finished.
+     * Otherwise `delay' is set to how long until it needs refilling again,
+     * which is negative if it's waiting on the decode threads, or the maximum
+     * if it's paused.
+     */
+    bool updateAsync(std::chrono::nanoseconds &delay);
+
+    std::chrono::steady_clock::time_point getStreamDeadline() const { return mStreamDeadline; }
+    void setStreamDeadline(std::chrono::steady_clock::time_point deadline) { mStreamDeadline = deadline; }
 
     void setGroup(ALSourceGroup *group);
     void unsetGroup();
 
     void groupUpdate();
-    void groupPropUpdate(ALfloat gain, ALfloat pitch);
+    void groupPropUpdate(ALfloat pitch);
+
+    // Whether the context may move the source between virtual and real
+    // playback. Only unpaused buffer sources are.
+    bool canVirtualize() const
+    {
+        return (mId != 0 || mVirtual) && mBuffer && !mStream &&
+               !mPaused.load(std::memory_order_acquire);
+    }
+    /* An estimate of how loud the source is, from its gain and its distance
+     * to the listener. Cones, filters, and effects are ignored.
+     */
+    ALfloat getAudibleGain(const Vector3 &listener, DistanceModel model) const;
+    // Estimated seconds of playback left, or infinity if it doesn't end.
+    ALfloat getRemainingTime() const;
+
+    ALfloat getVoiceGain() const { return mVoiceGain; }
+    ALfloat getVoiceScore() const { return mVoiceScore; }
+    void setVoiceScore(ALfloat gain, ALfloat score) { mVoiceGain = gain; mVoiceScore = score; }
+    size_t getVoiceIndex() const { return mVoiceIndex; }
+    void setVoiceIndex(size_t idx) { mVoiceIndex = idx; }
+    // Gives up the OpenAL source while keeping track of the play position.
+    void makeVirtual();
+    // Resumes playback on the given OpenAL source, from the tracked position.
+    void makeReal(ALuint id, bool fresh);
 
     void checkPaused();
-    void unsetPaused() { mPaused = false; }
+    void unsetPaused();
     void makeStopped();
 
     void play(Buffer *buffer) override final;
     void play(SharedPtr<Decoder> decoder, ALuint updatelen, ALuint queuesize) override final;
+    void playAdaptive(SharedPtr<Decoder> decoder, ALuint minupdatelen, ALuint maxupdatelen,
+                      ALuint minqueuesize, ALuint maxqueuesize) override final;
     void stop() override final;
     void pause() override final;
     void resume() override final;
 
     bool isPlaying() const override final;
     bool isPaused() const override final;
+    bool isVirtual() const override final { return mVirtual; }
 
     void setPriority(ALuint priority) override final;
     ALuint getPriority() const override final
@@ -40,7 +40,7 @@ void ALSourceGroup::update(ALfloat gain, ALfloat pitch)
     gain *= mGain;
     pitch *= mPitch;
     for(ALSource *alsrc : mSources)
-        alsrc->groupPropUpdate(gain, pitch);
+        alsrc->groupPropUpdate(pitch);
     for(ALSourceGroup *group : mSubGroups)
         group->update(gain, pitch);
 }
@@ -100,7 +100,6 @@ void ALSourceGroup::addSources(const Vector<Source*> &sources)
         if(!alsrcs.back()) throw std::runtime_error("Source is not valid");
     }
 
-    Batcher batcher = mContext->getBatcher();
     for(ALSource *alsrc : alsrcs)
     {
         auto iter = std::lower_bound(mSources.begin(), mSources.end(), alsrc);
@@ -113,7 +112,6 @@ void ALSourceGroup::addSources(const Vector<Source*> &sources)
 
 void ALSourceGroup::removeSources(const Vector<Source*> &sources)
 {
-    Batcher batcher = mContext->getBatcher();
     for(Source *source : sources)
     {
         auto iter = std::lower_bound(mSources.begin(), mSources.end(), source);
@@ -139,7 +137,6 @@ void ALSourceGroup::addSubGroup(SourceGroup *group)
         throw std::runtime_error("Attempted circular group chain");
 
     mSubGroups.insert(iter, algrp);
-    Batcher batcher = mContext->getBatcher();
     algrp->setParentGroup(this);
 }
 
@@ -148,7 +145,6 @@ void ALSourceGroup::removeSubGroup(SourceGroup *group)
     auto iter = std::lower_bound(mSubGroups.begin(), mSubGroups.end(), group);
     if(iter != mSubGroups.end() && *iter == group)
     {
-        Batcher batcher = mContext->getBatcher();
         (*iter)->unsetParentGroup();
         mSubGroups.erase(iter);
     }
@@ -180,9 +176,8 @@ void ALSourceGroup::setGain(ALfloat gain)
     mGain = gain;
     gain *= mParentProps.mGain;
     ALfloat pitch = mPitch * mParentProps.mPitch;
-    Batcher batcher = mContext->getBatcher();
     for(ALSource *alsrc : mSources)
-        alsrc->groupPropUpdate(gain, pitch);
+        alsrc->groupPropUpdate(pitch);
     for(ALSourceGroup *group : mSubGroups)
         group->update(gain, pitch);
 }
@@ -195,23 +190,28 @@ void ALSourceGroup::setPitch(ALfloat pitch)
     mPitch = pitch;
     ALfloat gain = mGain * mParentProps.mGain;
     pitch *= mParentProps.mPitch;
-    Batcher batcher = mContext->getBatcher();
     for(ALSource *alsrc : mSources)
-        alsrc->groupPropUpdate(gain, pitch);
+        alsrc->groupPropUpdate(pitch);
     for(ALSourceGroup *group : mSubGroups)
         group->update(gain, pitch);
 }
 
 
-void ALSourceGroup::collectPlayingSourceIds(Vector<ALuint> &sourceids) const
+bool ALSourceGroup::collectPlayingSourceIds(Vector<ALuint> &sourceids) const
 {
+    bool found = false;
     for(ALSource *alsrc : mSources)
     {
         if(alsrc->isPlaying())
-            sourceids.push_back(alsrc->getId());
+        {
+            if(ALuint id = alsrc->getId())
+                sourceids.push_back(id);
+            found = true;
+        }
     }
     for(ALSourceGroup *group : mSubGroups)
-        group->collectPlayingSourceIds(sourceids);
+        found |= group->collectPlayingSourceIds(sourceids);
+    return found;
 }
 
 void ALSourceGroup::updatePausedStatus() const
@@ -229,25 +229,31 @@ void ALSourceGroup::pauseAll() const
 
     Vector<ALuint> sourceids;
     sourceids.reserve(16);
-    collectPlayingSourceIds(sourceids);
-    if(!sourceids.empty())
+    if(collectPlayingSourceIds(sourceids))
     {
-        alSourcePausev(sourceids.size(), sourceids.data());
+        if(!sourceids.empty())
+            alSourcePausev(sourceids.size(), sourceids.data());
         updatePausedStatus();
     }
     lock.unlock();
 }
 
 
-void ALSourceGroup::collectPausedSourceIds(Vector<ALuint> &sourceids) const
+bool ALSourceGroup::collectPausedSourceIds(Vector<ALuint> &sourceids) const
 {
+    bool found = false;
     for(ALSource *alsrc : mSources)
     {
         if(alsrc->isPaused())
-            sourceids.push_back(alsrc->getId());
+        {
+            if(ALuint id = alsrc->getId())
+                sourceids.push_back(id);
+            found = true;
+        }
     }
     for(ALSourceGroup *group : mSubGroups)
-        group->collectPausedSourceIds(sourceids);
+        found |= group->collectPausedSourceIds(sourceids);
+    return found;
 }
 
 void ALSourceGroup::updatePlayingStatus() const
@@ -265,25 +271,32 @@ void ALSourceGroup::resumeAll() const
 
     Vector<ALuint> sourceids;
     sourceids.reserve(16);
-    collectPausedSourceIds(sourceids);
-    if(!sourceids.empty())
+    if(collectPausedSourceIds(sourceids))
     {
-        alSourcePlayv(sourceids.size(), sourceids.data());
+        if(!sourceids.empty())
+            alSourcePlayv(sourceids.size(), sourceids.data());
         updatePlayingStatus();
     }
     lock.unlock();
 }
 
 
-void ALSourceGroup::collectSourceIds(Vector<ALuint> &sourceids) const
+bool ALSourceGroup::collectSourceIds(Vector<ALuint> &sourceids) const
 {
+    bool found = false;
     for(ALSource *alsrc : mSources)
     {
         if(ALuint id = alsrc->getId())
+        {
             sourceids.push_back(id);
+            found = true;
+        }
+        else if(alsrc->isVirtual())
+            found = true;
     }
     for(ALSourceGroup *group : mSubGroups)
-        group->collectSourceIds(sourceids);
+        found |= group->collectSourceIds(sourceids);
+    return found;
 }
 
 void ALSourceGroup::updateStoppedStatus() const
@@ -304,10 +317,10 @@ void ALSourceGroup::stopAll() const
 
     Vector<ALuint> sourceids;
     sourceids.reserve(16);
-    collectSourceIds(sourceids);
-    if(!sourceids.empty())
+    if(collectSourceIds(sourceids))
     {
-        alSourceRewindv(sourceids.size(), sourceids.data());
+        if(!sourceids.empty())
+            alSourceRewindv(sourceids.size(), sourceids.data());
         updateStoppedStatus();
     }
     lock.unlock();
@@ -317,7 +330,6 @@ void ALSourceGroup::stopAll() const
 void ALSourceGroup::release()
 {
     CheckContext(mContext);
-    Batcher batcher = mContext->getBatcher();
     for(ALSource *source : mSources)
         source->unsetGroup();
     mSources.clear();
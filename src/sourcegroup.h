@@ -45,13 +45,15 @@ class ALSourceGroup : public SourceGroup, SourceGroupProps {
 
     bool findInSubGroups(ALSourceGroup *group) const;
 
-    void collectPlayingSourceIds(Vector<ALuint> &sourceids) const;
+    // These return true if any sources were found, including virtual ones
+    // that have no ID to collect.
+    bool collectPlayingSourceIds(Vector<ALuint> &sourceids) const;
     void updatePausedStatus() const;
 
-    void collectPausedSourceIds(Vector<ALuint> &sourceids) const;
+    bool collectPausedSourceIds(Vector<ALuint> &sourceids) const;
     void updatePlayingStatus() const;
 
-    void collectSourceIds(Vector<ALuint> &sourceids) const;
+    bool collectSourceIds(Vector<ALuint> &sourceids) const;
     void updateStoppedStatus() const;
 
 public:
@@ -0,0 +1,173 @@
+
+#include "config.h"
+
+#include "streamdecoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <limits>
+
+
+namespace alure
+{
+
+static inline size_t RoundUp8(size_t size)
+{ return (size+7) & ~size_t(7); }
+
+
+StreamDecoder::StreamDecoder(SharedPtr<Decoder> decoder, ALuint updatelen, ALuint numblocks,
+                             ALuint framesize, ALbyte silence, std::pair<uint64_t,uint64_t> looppts)
+  : mDecoder(std::move(decoder)), mUpdateLen(updatelen), mFrameSize(framesize),
+    mSilence(silence), mLoopPts(looppts), mHasLooped(false), mLooping(false), mDone(false),
+    mQueued(false), mCancelled(false), mReady(0), mDecodeTime(0),
+    mHeaderSize(RoundUp8(sizeof(BlockHeader))),
+    mBlocks(MakeUnique<RingBuffer>(numblocks+1, mHeaderSize + RoundUp8(updatelen*framesize)))
+{
+}
+
+
+uint64_t StreamDecoder::getLength()
+{
+    std::lock_guard<std::mutex> lock(mDecoderMutex);
+    return mDecoder->getLength();
+}
+
+
+ALuint StreamDecoder::readLooped(ALbyte *dst)
+{
+    ALuint frames;
+    bool loop = mLooping.load(std::memory_order_acquire);
+    if(!loop)
+        frames = mDecoder->read(dst, mUpdateLen);
+    else
+    {
+        ALuint len = mUpdateLen;
+        uint64_t pos = mDecoder->getPosition();
+        if(pos <= mLoopPts.second)
+            len = std::min<uint64_t>(len, mLoopPts.second - pos);
+        else
+            loop = false;
+
+        frames = mDecoder->read(dst, len);
+        if(frames < mUpdateLen && loop && pos+frames > 0)
+        {
+            if(pos+frames < mLoopPts.second)
+            {
+                mLoopPts.second = pos+frames;
+                mLoopPts.first = std::min(mLoopPts.first, mLoopPts.second-1);
+            }
+
+            do {
+                if(!mDecoder->seek(mLoopPts.first))
+                    break;
+                mHasLooped = true;
+
+                len = std::min<uint64_t>(mUpdateLen-frames, mLoopPts.second-mLoopPts.first);
+                ALuint got = mDecoder->read(&dst[frames*mFrameSize], len);
+                if(got == 0) break;
+                frames += got;
+            } while(frames < mUpdateLen);
+        }
+    }
+    return frames;
+}
+
+bool StreamDecoder::decode(size_t count)
+{
+    std::lock_guard<std::mutex> lock(mDecoderMutex);
+    bool starved = (mReady.load() == 0);
+
+    while(count > 0 && !mDone.load(std::memory_order_acquire))
+    {
+        auto vec = mBlocks->get_write_vector();
+        if(vec[0].len == 0) break;
+
+        ALbyte *dst = reinterpret_cast<ALbyte*>(vec[0].buf + mHeaderSize);
+        auto start = std::chrono::steady_clock::now();
+        ALuint frames = readLooped(dst);
+        mDecodeTime.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start
+        ).count(), std::memory_order_relaxed);
+        if(frames == 0)
+        {
+            mDone.store(true, std::memory_order_release);
+            break;
+        }
+        if(frames < mUpdateLen)
+            std::fill(dst + frames*mFrameSize, dst + mUpdateLen*mFrameSize, mSilence);
+
+        BlockHeader *header = reinterpret_cast<BlockHeader*>(vec[0].buf);
+        header->mPosition = mDecoder->getPosition();
+        header->mLoopStart = mLoopPts.first;
+        header->mLoopEnd = mLoopPts.second;
+        header->mFrames = frames;
+        header->mHasLooped = mHasLooped;
+        mBlocks->write_advance(1);
+        ++mReady;
+        --count;
+
+        // Only flag the end after the last block is readable, so the reader
+        // never sees it as done with data still pending.
+        if(frames < mUpdateLen)
+            mDone.store(true, std::memory_order_release);
+    }
+
+    return starved;
+}
+
+bool StreamDecoder::seek(uint64_t pos)
+{
+    std::lock_guard<std::mutex> lock(mDecoderMutex);
+    if(!mDecoder->seek(pos))
+        return false;
+    mBlocks->reset();
+    mReady.store(0);
+    mHasLooped = false;
+    mDone.store(false, std::memory_order_release);
+    return true;
+}
+
+
+bool StreamDecoder::resize(ALuint updatelen, ALuint numblocks)
+{
+    std::lock_guard<std::mutex> lock(mDecoderMutex);
+    if(mReady.load() > 0)
+        return false;
+
+    mBlocks = MakeUnique<RingBuffer>(numblocks+1, mHeaderSize + RoundUp8(updatelen*mFrameSize));
+    mUpdateLen = updatelen;
+    return true;
+}
+
+
+bool StreamDecoder::front(BlockHeader &header, const ALbyte *&data) const
+{
+    auto vec = mBlocks->get_read_vector();
+    if(vec[0].len == 0)
+        return false;
+    memcpy(&header, vec[0].buf, sizeof(header));
+    data = reinterpret_cast<const ALbyte*>(vec[0].buf + mHeaderSize);
+    return true;
+}
+
+
+bool StreamDecoder::process()
+{
+    bool starved = false;
+    while(!mCancelled.load(std::memory_order_acquire))
+    {
+        starved |= decode(std::numeric_limits<size_t>::max());
+        mQueued.store(false, std::memory_order_release);
+
+        // The reader may have freed more space after the ring filled, but
+        // before the flag was cleared. The ring may be replaced by the reader,
+        // so it's only checked here with the decoder mutex held.
+        std::lock_guard<std::mutex> lock(mDecoderMutex);
+        if(mDone.load(std::memory_order_acquire) || mBlocks->write_space() == 0 || !markQueued())
+            break;
+    }
+    return starved;
+}
+
+} // namespace alure
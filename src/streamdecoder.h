@@ -0,0 +1,121 @@
+#ifndef STREAMDECODER_H
+#define STREAMDECODER_H
+
+#include "main.h"
+
+#include <atomic>
+#include <mutex>
+
+#include "ringbuf.h"
+
+namespace alure {
+
+/* Decodes a streaming source's audio ahead of playback, into a ring of
+ * fixed-size blocks. This makes no OpenAL calls, so the context's decode
+ * threads can fill it while the background thread only copies finished blocks
+ * into the source's buffer queue.
+ *
+ * Blocks are written by one decoding thread at a time (serialized by the
+ * decoder mutex) and read by whichever thread owns the source.
+ */
+class StreamDecoder {
+public:
+    struct BlockHeader {
+        // Decoder position and loop state after this block was decoded
+        uint64_t mPosition;
+        uint64_t mLoopStart;
+        uint64_t mLoopEnd;
+        ALuint mFrames;
+        bool mHasLooped;
+    };
+
+private:
+    std::mutex mDecoderMutex;
+    SharedPtr<Decoder> mDecoder;
+
+    // Only changed by the reading thread, while holding the decoder mutex
+    // with no blocks ready.
+    ALuint mUpdateLen;
+    const ALuint mFrameSize;
+    const ALbyte mSilence;
+
+    // Only accessed while holding the decoder mutex
+    std::pair<uint64_t,uint64_t> mLoopPts;
+    bool mHasLooped;
+
+    std::atomic<bool> mLooping;
+    std::atomic<bool> mDone;
+    std::atomic<bool> mQueued;
+    std::atomic<bool> mCancelled;
+
+    // Number of blocks ready for reading, so other threads can check without
+    // touching the ring.
+    std::atomic<size_t> mReady;
+    // Time taken to decode the most recent block, in nanoseconds
+    std::atomic<uint64_t> mDecodeTime;
+
+    size_t mHeaderSize;
+    UniquePtr<RingBuffer> mBlocks;
+
+    ALuint readLooped(ALbyte *dst);
+
+public:
+    StreamDecoder(SharedPtr<Decoder> decoder, ALuint updatelen, ALuint numblocks,
+                  ALuint framesize, ALbyte silence, std::pair<uint64_t,uint64_t> looppts);
+    StreamDecoder(const StreamDecoder&) = delete;
+
+    ALuint getUpdateLength() const { return mUpdateLen; }
+    ALuint getFrameSize() const { return mFrameSize; }
+
+    uint64_t getLength();
+
+    void setLooping(bool looping) { mLooping.store(looping, std::memory_order_release); }
+
+    /* Decodes up to `count' more blocks, stopping early if the ring fills or
+     * the decoder runs out. Returns true if there were no blocks ready for
+     * reading beforehand.
+     */
+    bool decode(size_t count);
+
+    /* Seeks the decoder and discards any blocks decoded ahead. Must be called
+     * from the reading thread.
+     */
+    bool seek(uint64_t pos);
+
+    /* Changes the block length and ring size. Only succeeds once every decoded
+     * block has been read, so no data is dropped. Must be called from the
+     * reading thread.
+     */
+    bool resize(ALuint updatelen, ALuint numblocks);
+
+    /* Retrieves the oldest decoded block, if any. */
+    bool front(BlockHeader &header, const ALbyte *&data) const;
+    /* Releases the block retrieved with front. */
+    void pop() { mBlocks->read_advance(1); --mReady; }
+
+    bool hasMoreData() const
+    { return !mDone.load(std::memory_order_acquire) || mReady.load() > 0; }
+
+    /* Must be called from the reading thread. */
+    bool needsDecode() const
+    { return !mDone.load(std::memory_order_acquire) && mBlocks->write_space() > 0; }
+
+    uint64_t getDecodeTime() const { return mDecodeTime.load(std::memory_order_relaxed); }
+
+    /* Flags the stream as queued for a decode thread. Returns false if it
+     * already was.
+     */
+    bool markQueued() { return !mQueued.exchange(true, std::memory_order_acq_rel); }
+
+    /* Called by a decode thread for a queued stream. Fills the ring and clears
+     * the queued flag. Returns true if the reader had run out of blocks.
+     */
+    bool process();
+
+    /* Stops any further decoding, for when the stream is no longer played. */
+    void cancel() { mCancelled.store(true, std::memory_order_release); }
+};
+
+} // namespace alure
+
+#endif /* STREAMDECODER_H */
@@ -0,0 +1,187 @@
+
+#include "config.h"
+
+#include "trace.h"
+
+#include <ostream>
+
+#ifdef ALURE_ENABLE_TRACING
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#endif
+
+
+namespace alure
+{
+
+#ifdef ALURE_ENABLE_TRACING
+
+namespace {
+
+struct TraceEvent {
+    const char *mName;
+    uint64_t mStart;
+    uint64_t mEnd;
+};
+
+/* Events recorded by one thread. Only the owning thread adds to it, and once
+ * it fills up further events are dropped instead of overwriting old ones, so
+ * it can be read from another thread without locking.
+ *
+ * Clearing only flags the buffer, and the owning thread empties it when it
+ * next records an event. Until then the writer skips it.
+ */
+struct TraceBuffer {
+    static constexpr size_t sCapacity = 16384;
+
+    std::atomic<size_t> mCount;
+    std::atomic<uint64_t> mDropped;
+    std::atomic<bool> mCleared;
+    // Set when the owning thread ends, after which nothing else touches it.
+    std::atomic<bool> mFinished;
+    const ALuint mThreadId;
+    TraceEvent mEvents[sCapacity];
+
+    TraceBuffer(ALuint tid)
+      : mCount(0), mDropped(0), mCleared(false), mFinished(false), mThreadId(tid)
+    { }
+};
+
+// Every thread's buffer, kept after the thread ends so its events can still
+// be written out, until the trace is cleared. The mutex is only taken when a
+// thread first records an event, and when writing or clearing the trace.
+std::mutex sTraceMutex;
+Vector<UniquePtr<TraceBuffer>> sTraceBuffers;
+ALuint sNextThreadId = 1;
+
+// Lets the buffer go when its thread ends.
+struct ThreadTrace {
+    TraceBuffer *mBuffer;
+
+    ThreadTrace() : mBuffer(nullptr) { }
+    ~ThreadTrace()
+    {
+        if(mBuffer)
+            mBuffer->mFinished.store(true, std::memory_order_release);
+    }
+};
+thread_local ThreadTrace sThreadTrace;
+
+TraceBuffer *GetThreadTrace()
+{
+    if(!sThreadTrace.mBuffer)
+    {
+        std::lock_guard<std::mutex> lock(sTraceMutex);
+        sTraceBuffers.emplace_back(MakeUnique<TraceBuffer>(sNextThreadId++));
+        sThreadTrace.mBuffer = sTraceBuffers.back().get();
+    }
+    return sThreadTrace.mBuffer;
+}
+
+// Writes nanoseconds as microseconds, which trace events are measured in.
+void WriteMicroseconds(std::ostream &stream, uint64_t ns)
+{
+    char str[32];
+    snprintf(str, sizeof(str), "%llu.%03u", (unsigned long long)(ns/1000), (unsigned int)(ns%1000));
+    stream<< str;
+}
+
+} // namespace
+
+uint64_t TraceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// Event times are written relative to when the library was loaded.
+static const uint64_t sTraceBase = TraceNow();
+
+void TraceRecord(const char *name, uint64_t start, uint64_t end)
+{
+    TraceBuffer *trace = GetThreadTrace();
+    if(trace->mCleared.load(std::memory_order_acquire))
+    {
+        trace->mCount.store(0, std::memory_order_relaxed);
+        trace->mDropped.store(0, std::memory_order_relaxed);
+        trace->mCleared.store(false, std::memory_order_release);
+    }
+    size_t count = trace->mCount.load(std::memory_order_relaxed);
+    if(count == TraceBuffer::sCapacity)
+    {
+        trace->mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    trace->mEvents[count] = TraceEvent{name, start, end};
+    trace->mCount.store(count+1, std::memory_order_release);
+}
+
+
+bool WriteTrace(std::ostream &stream)
+{
+    std::lock_guard<std::mutex> lock(sTraceMutex);
+
+    uint64_t dropped = 0;
+    const char *sep = "\n";
+    stream<< "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for(const auto &trace : sTraceBuffers)
+    {
+        if(trace->mCleared.load(std::memory_order_acquire))
+            continue;
+
+        stream<< sep<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"<<trace->mThreadId
+              << ",\"args\":{\"name\":\"alure thread "<<trace->mThreadId<<"\"}}";
+        sep = ",\n";
+
+        size_t count = trace->mCount.load(std::memory_order_acquire);
+        for(size_t i = 0;i < count;++i)
+        {
+            const TraceEvent &event = trace->mEvents[i];
+            stream<< sep<< "{\"name\":\""<<event.mName<<"\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                  <<trace->mThreadId<<",\"ts\":";
+            WriteMicroseconds(stream, event.mStart - std::min(event.mStart, sTraceBase));
+            stream<< ",\"dur\":";
+            WriteMicroseconds(stream, event.mEnd - event.mStart);
+            stream<< "}";
+        }
+        dropped += trace->mDropped.load(std::memory_order_relaxed);
+    }
+    stream<< "\n],\"otherData\":{\"droppedEvents\":"<<dropped<<"}}\n";
+
+    return stream.good();
+}
+
+void ClearTrace()
+{
+    std::lock_guard<std::mutex> lock(sTraceMutex);
+
+    // Buffers from threads that have ended can go. The rest are emptied by
+    // their threads.
+    auto iter = std::remove_if(sTraceBuffers.begin(), sTraceBuffers.end(),
+        [](const UniquePtr<TraceBuffer> &trace) -> bool
+        { return trace->mFinished.load(std::memory_order_acquire); }
+    );
+    sTraceBuffers.erase(iter, sTraceBuffers.end());
+    for(const auto &trace : sTraceBuffers)
+        trace->mCleared.store(true, std::memory_order_release);
+}
+
+#else
+
+bool WriteTrace(std::ostream &stream)
+{
+    stream<< "{\"traceEvents\":[]}\n";
+    return false;
+}
+
+void ClearTrace()
+{
+}
+
+#endif
+
+} // namespace alure
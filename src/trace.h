@@ -0,0 +1,42 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "main.h"
+
+#ifdef ALURE_ENABLE_TRACING
+
+namespace alure {
+
+// Current time in nanoseconds, on the clock used for trace events.
+uint64_t TraceNow();
+// Adds an event to the calling thread's trace buffer. The name must be a
+// string literal, as only the pointer is kept.
+void TraceRecord(const char *name, uint64_t start, uint64_t end);
+
+// Records the time between its construction and destruction as a trace event.
+class TraceZone {
+    const char *mName;
+    uint64_t mStart;
+
+public:
+    explicit TraceZone(const char *name) : mName(name), mStart(TraceNow()) { }
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+    ~TraceZone() { TraceRecord(mName, mStart, TraceNow()); }
+};
+
+} // namespace alure
+
+#define ALURE_TRACE_CONCAT2(a, b) a##b
+#define ALURE_TRACE_CONCAT(a, b) ALURE_TRACE_CONCAT2(a, b)
+/* Traces the rest of the enclosing scope under the given name. */
+#define ALURE_TRACE_ZONE(name) \
+    ::alure::TraceZone ALURE_TRACE_CONCAT(alure_trace_zone_, __LINE__)(name)
+
+#else
+
+#define ALURE_TRACE_ZONE(name) ((void)0)
+
+#endif
+
+#endif /* TRACE_H */